@@ -21,11 +21,75 @@ along with The Arduino WiFiEsp library.  If not, see
 
 int16_t 	WiFiEspClass::_state[MAX_SOCK_NUM] = { NA_STATE, NA_STATE, NA_STATE, NA_STATE };
 uint16_t 	WiFiEspClass::_server_port[MAX_SOCK_NUM] = { 0, 0, 0, 0 };
+bool 		WiFiEspClass::_listening[MAX_SOCK_NUM] = { false, false, false, false };
+int16_t 	WiFiEspClass::_accepted[MAX_SOCK_NUM] = { NA_STATE, NA_STATE, NA_STATE, NA_STATE };
+
+uint8_t 	WiFiEspClass::_rxBuf[MAX_SOCK_NUM][WIFIESP_RX_BUFFER_SIZE];
+uint16_t 	WiFiEspClass::_rxHead[MAX_SOCK_NUM] = { 0, 0, 0, 0 };
+uint16_t 	WiFiEspClass::_rxTail[MAX_SOCK_NUM] = { 0, 0, 0, 0 };
+bool 		WiFiEspClass::_rxOpportunistic[MAX_SOCK_NUM] = { false, false, false, false };
+
+uint8_t 	WiFiEspClass::_txBuf[MAX_SOCK_NUM][WIFIESP_TX_BUFFER_SIZE];
+uint16_t 	WiFiEspClass::_txLen[MAX_SOCK_NUM] = { 0, 0, 0, 0 };
+unsigned long 	WiFiEspClass::_txTime[MAX_SOCK_NUM] = { 0, 0, 0, 0 };
+bool 		WiFiEspClass::_txCoalesce[MAX_SOCK_NUM] = { false, false, false, false };
+esp32_spi_net_t WiFiEspClass::_net;
+bool 		WiFiEspClass::_netValid = false;
+unsigned long 	WiFiEspClass::_netTime = 0;
+uint8_t 	WiFiEspClass::_netStatus = WL_IDLE_STATUS;
+
+uint8_t 	WiFiEspClass::_sockState[MAX_SOCK_NUM] = { SOCKET_CLOSED, SOCKET_CLOSED, SOCKET_CLOSED, SOCKET_CLOSED };
+int 		WiFiEspClass::_sockAvail[MAX_SOCK_NUM] = { 0, 0, 0, 0 };
+bool 		WiFiEspClass::_sockValid[MAX_SOCK_NUM] = { false, false, false, false };
+unsigned long 	WiFiEspClass::_sockTime[MAX_SOCK_NUM] = { 0, 0, 0, 0 };
+unsigned long 	WiFiEspClass::_sockWindow = WIFIESP_SOCK_STATE_WINDOW_MS;
+
+uint8_t 	WiFiEspClass::_writeChunk[WIFIESP_WRITE_CHUNK_SIZE];
+bool 		WiFiEspClass::_connecting[MAX_SOCK_NUM] = { false, false, false, false };
+unsigned long 	WiFiEspClass::_connStart[MAX_SOCK_NUM] = { 0, 0, 0, 0 };
+unsigned long 	WiFiEspClass::_connPolled[MAX_SOCK_NUM] = { 0, 0, 0, 0 };
+unsigned long 	WiFiEspClass::_connTimeout[MAX_SOCK_NUM] = { 0, 0, 0, 0 };
+uint16_t 	WiFiEspClass::_txChunk[MAX_SOCK_NUM] = { WIFIESP_WRITE_CHUNK_SIZE, WIFIESP_WRITE_CHUNK_SIZE, WIFIESP_WRITE_CHUNK_SIZE, WIFIESP_WRITE_CHUNK_SIZE };
 
 
 uint8_t WiFiEspClass::espMode = 0;
 
-esp32_spi_aps_list_t *aps_list;
+uint8_t 	WiFiEspClass::_ipConfig[3][4];
+uint8_t 	WiFiEspClass::_ipConfigParams = 0;
+uint8_t 	WiFiEspClass::_dnsConfig[2][4];
+uint8_t 	WiFiEspClass::_dnsConfigParams = 0;
+char 		WiFiEspClass::_hostname[ESP32_SPI_HOSTNAME_MAX + 1] = "";
+
+int8_t 		WiFiEspClass::_initState = WIFIESP_INIT_FAILED;
+bool 		WiFiEspClass::_initStarted = false;
+bool 		WiFiEspClass::_beginPending = false;
+
+char 		WiFiEspClass::_ssid[33] = "";
+char 		WiFiEspClass::_pass[65] = "";
+bool 		WiFiEspClass::_autoReconnect = true;
+uint8_t 	WiFiEspClass::_linkStatus = WL_IDLE_STATUS;
+bool 		WiFiEspClass::_linkJoining = false;
+unsigned long 	WiFiEspClass::_linkPolled = 0;
+unsigned long 	WiFiEspClass::_linkRetryAt = 0;
+unsigned long 	WiFiEspClass::_linkJoinStart = 0;
+unsigned long 	WiFiEspClass::_linkBackoff = WIFIESP_RECONNECT_MIN_MS;
+uint8_t 	WiFiEspClass::_lastBssid[WL_MAC_ADDR_LENGTH] = { 0, 0, 0, 0, 0, 0 };
+uint8_t 	WiFiEspClass::_lastChannel = 0;
+WiFiEspLinkCallback WiFiEspClass::_linkCallback = NULL;
+
+esp32_spi_ap_t 	WiFiEspClass::_aps[WL_NETWORKS_LIST_MAXNUM];
+uint8_t 	WiFiEspClass::_apsNum = 0;
+uint8_t 	WiFiEspClass::_apsOrder[WL_NETWORKS_LIST_MAXNUM];
+bool 		WiFiEspClass::_apsSeen[WL_NETWORKS_LIST_MAXNUM];
+uint8_t 	WiFiEspClass::_apsIdx[WL_NETWORKS_LIST_MAXNUM];
+bool 		WiFiEspClass::_apsExtras[WL_NETWORKS_LIST_MAXNUM];
+
+esp32_spi_ap_t 	WiFiEspClass::_scanBuf[WL_NETWORKS_LIST_MAXNUM];
+uint8_t 	WiFiEspClass::_scanMerged = 0;
+bool 		WiFiEspClass::_scanRunning = false;
+bool 		WiFiEspClass::_scanFailed = false;
+unsigned long 	WiFiEspClass::_scanStart = 0;
+WiFiEspScanCallback WiFiEspClass::_scanCallback = NULL;
 
 SPIClass& WiFiEspClass::spi_ = SPI;
 
@@ -36,6 +100,19 @@ WiFiEspClass::WiFiEspClass()
 }
 
 void WiFiEspClass::init()
+{
+	initAsync();
+	while (initPoll() == WIFIESP_INIT_RUNNING)
+		delay(1);
+}
+
+void WiFiEspClass::init(SPIClass& spi)
+{
+	spi_ = spi;
+	init();
+}
+
+void WiFiEspClass::initAsync()
 {
 	LOGINFO(F("Initializing ESP module"));
 	fpioa_set_function(25, FUNC_GPIOHS10); //CS
@@ -50,8 +127,9 @@ void WiFiEspClass::init()
 		fpioa_set_function(26, FUNC_GPIOHS14); //MISO
 		fpioa_set_function(27, FUNC_GPIOHS15); //SCLK
 
-		esp32_spi_init(10, 11, 12, 0);
+		// the pins carry the boot probes, so they come first
 		soft_spi_config_io(13, 14, 15);
+		esp32_spi_init_start(10, 11, 12, 0);
 	}
 	else
 	{
@@ -60,15 +138,37 @@ void WiFiEspClass::init()
 //		fpioa_set_function(26, FUNC_SPI1_D1); //MISO
 //		fpioa_set_function(27, FUNC_SPI1_SCLK); //SCLK
 
-		esp32_spi_init(10, 11, 12, 1);
 		hard_spi_config_io();
+		esp32_spi_init_start(10, 11, 12, 1);
 	}
+	_initState = WIFIESP_INIT_RUNNING;
+	_initStarted = true;
 }
 
-void WiFiEspClass::init(SPIClass& spi)
+void WiFiEspClass::initAsync(SPIClass& spi)
 {
 	spi_ = spi;
-	init();
+	initAsync();
+}
+
+int8_t WiFiEspClass::initPoll()
+{
+	if (_initState != WIFIESP_INIT_RUNNING)
+		return _initState;
+
+	int8_t r = esp32_spi_boot_poll();
+	if (r > 0)
+	{
+		// config() and friends called while booting could not reach the module
+		applyConfig();
+		_initState = WIFIESP_INIT_READY;
+	}
+	else if (r < 0)
+	{
+		LOGERROR(F("ESP module not responding"));
+		_initState = WIFIESP_INIT_FAILED;
+	}
+	return _initState;
 }
 
 
@@ -81,13 +181,206 @@ char* WiFiEspClass::firmwareVersion()
 
 int WiFiEspClass::begin(const char* ssid, const char* passphrase)
 {
+	_netValid = false;
 	espMode = 1;
+	linkCredentials(ssid, passphrase);
+
 	if (esp32_spi_connect_AP((uint8_t *)ssid, (uint8_t *)passphrase, 5) == 0)
+	{
+		_linkStatus = WL_CONNECTED;
+		linkUp();
 		return WL_CONNECTED;
+	}
 
 	return WL_CONNECT_FAILED;
 }
 
+void WiFiEspClass::beginAsync(const char* ssid, const char* passphrase)
+{
+	_netValid = false;
+	espMode = 1;
+	linkCredentials(ssid, passphrase);
+	_beginPending = true;
+}
+
+uint8_t WiFiEspClass::beginPoll()
+{
+	int8_t init = initPoll();
+	if (init == WIFIESP_INIT_RUNNING)
+		return WL_IDLE_STATUS;
+	if (init == WIFIESP_INIT_FAILED)
+	{
+		_beginPending = false;
+		return WL_NO_SHIELD;
+	}
+	if (!_beginPending)
+		return _linkStatus;
+
+	unsigned long now = millis();
+	if (!_linkJoining)
+	{
+		if (esp32_spi_connect_AP_start((uint8_t *)_ssid, _pass[0] ? (uint8_t *)_pass : NULL) != 0)
+		{
+			_beginPending = false;
+			_linkStatus = WL_CONNECT_FAILED;
+			return _linkStatus;
+		}
+		_linkJoining = true;
+		_linkJoinStart = now;
+		_linkPolled = now;
+		return WL_IDLE_STATUS;
+	}
+
+	if (now - _linkPolled < WIFIESP_BEGIN_POLL_MS)
+		return WL_IDLE_STATUS;
+	_linkPolled = now;
+
+	uint8_t s = status();
+	if (s == WL_CONNECTED)
+	{
+		_beginPending = false;
+		_linkStatus = WL_CONNECTED;
+		linkUp();
+		if (_linkCallback)
+			_linkCallback(s);
+		return s;
+	}
+
+	if (s == WL_CONNECT_FAILED || now - _linkJoinStart >= WIFIESP_BEGIN_TIMEOUT_MS)
+	{
+		_beginPending = false;
+		_linkJoining = false;
+		_linkStatus = WL_CONNECT_FAILED;
+		return _linkStatus;
+	}
+
+	return WL_IDLE_STATUS;
+}
+
+uint8_t WiFiEspClass::maintain()
+{
+	txFlushAllDue();
+
+	// the first join is still being driven by beginPoll()
+	if (_beginPending)
+		return beginPoll();
+
+	unsigned long now = millis();
+	if (now - _linkPolled < WIFIESP_LINK_POLL_MS)
+		return _linkStatus;
+	_linkPolled = now;
+
+	uint8_t s = status();
+	if (s != _linkStatus)
+	{
+		uint8_t prev = _linkStatus;
+		_linkStatus = s;
+
+		if (s == WL_CONNECTED)
+			linkUp();
+		else if (prev == WL_CONNECTED)
+		{
+			// first attempt right away, the backoff starts after it fails
+			_linkBackoff = WIFIESP_RECONNECT_MIN_MS;
+			_linkRetryAt = now;
+		}
+
+		if (_linkCallback)
+			_linkCallback(s);
+	}
+
+	if (s == WL_CONNECTED || !_autoReconnect || _ssid[0] == 0)
+		return s;
+
+	if (_linkJoining)
+	{
+		if (s == WL_CONNECT_FAILED || now - _linkJoinStart >= WIFIESP_RECONNECT_ATTEMPT_MS)
+		{
+			LOGWARN1(F("Reconnect failed, status"), s);
+			_linkJoining = false;
+			linkRetryLater(now);
+		}
+		return s;
+	}
+
+	if ((long)(now - _linkRetryAt) >= 0)
+	{
+		LOGINFO1(F("Reconnecting to"), _ssid);
+		_netValid = false;
+		if (esp32_spi_connect_AP_start((uint8_t *)_ssid, _pass[0] ? (uint8_t *)_pass : NULL) == 0)
+		{
+			_linkJoining = true;
+			_linkJoinStart = now;
+		}
+		else
+			linkRetryLater(now);
+	}
+
+	return s;
+}
+
+void WiFiEspClass::setAutoReconnect(bool enable)
+{
+	_autoReconnect = enable;
+}
+
+void WiFiEspClass::onLinkChange(WiFiEspLinkCallback callback)
+{
+	_linkCallback = callback;
+}
+
+uint8_t* WiFiEspClass::lastBSSID(uint8_t* bssid)
+{
+	memcpy(bssid, _lastBssid, WL_MAC_ADDR_LENGTH);
+	return bssid;
+}
+
+uint8_t WiFiEspClass::lastChannel()
+{
+	return _lastChannel;
+}
+
+// kept for maintain() to rejoin with
+void WiFiEspClass::linkCredentials(const char* ssid, const char* passphrase)
+{
+	strncpy(_ssid, ssid, sizeof(_ssid) - 1);
+	_ssid[sizeof(_ssid) - 1] = 0;
+	strncpy(_pass, passphrase ? passphrase : "", sizeof(_pass) - 1);
+	_pass[sizeof(_pass) - 1] = 0;
+	_linkJoining = false;
+	_beginPending = false;
+}
+
+// remember where we got in, and reset the backoff
+void WiFiEspClass::linkUp()
+{
+	_linkJoining = false;
+	_linkBackoff = WIFIESP_RECONNECT_MIN_MS;
+
+	uint8_t *bssid = esp32_spi_get_bssid();
+	if (bssid == NULL)
+		return;
+	memcpy(_lastBssid, bssid, WL_MAC_ADDR_LENGTH);
+
+	// only our own network is worth the BSSID and channel round trips
+	_lastChannel = 0;
+	for (uint8_t i = 0; i < _apsNum; i++)
+	{
+		if (strcmp((char *)_aps[i].ssid, _ssid) == 0 && scanExtras(i)
+			&& memcmp(_aps[i].bssid, _lastBssid, WL_MAC_ADDR_LENGTH) == 0)
+			_lastChannel = _aps[i].channel;
+	}
+}
+
+// jitter keeps devices that dropped together from retrying in lockstep
+void WiFiEspClass::linkRetryLater(unsigned long now)
+{
+	_linkRetryAt = now + _linkBackoff + random(_linkBackoff / 4 + 1);
+	_linkBackoff *= 2;
+	if (_linkBackoff > WIFIESP_RECONNECT_MAX_MS)
+		_linkBackoff = WIFIESP_RECONNECT_MAX_MS;
+}
+
 
 int WiFiEspClass::beginAP(const char* ssid, uint8_t channel, const char* pwd, uint8_t enc, bool apOnly)
 {
@@ -95,6 +388,8 @@ int WiFiEspClass::beginAP(const char* ssid, uint8_t channel, const char* pwd, ui
 		espMode = 2;
 	else
 		espMode = 3;
+
+	_netValid = false;
 	
 	if (esp32_spi_ap_pass_phrase((uint8_t *)ssid, (uint8_t *)pwd, channel) == 0)
 		return WL_CONNECTED;
@@ -115,12 +410,82 @@ int WiFiEspClass::beginAP(const char* ssid, uint8_t channel)
 
 void WiFiEspClass::config(IPAddress ip)
 {
-	uint8_t _ip[4];
-	_ip[0] = ip[0];
-	_ip[1] = ip[1];
-	_ip[2] = ip[2];
-	_ip[3] = ip[3];
-	esp32_spi_ip_address(_ip);
+	// esp32_spi_set_ip_config derives the gateway and netmask, DNS goes to the gateway
+	ipConfig(1, ip, IPAddress(0, 0, 0, 0), IPAddress(0, 0, 0, 0));
+	dnsConfig(1, IPAddress(ip[0], ip[1], ip[2], 1), IPAddress(0, 0, 0, 0));
+}
+
+void WiFiEspClass::config(IPAddress ip, IPAddress dns_server)
+{
+	ipConfig(1, ip, IPAddress(0, 0, 0, 0), IPAddress(0, 0, 0, 0));
+	dnsConfig(1, dns_server, IPAddress(0, 0, 0, 0));
+}
+
+void WiFiEspClass::config(IPAddress ip, IPAddress dns_server, IPAddress gateway)
+{
+	ipConfig(2, ip, gateway, IPAddress(0, 0, 0, 0));
+	dnsConfig(1, dns_server, IPAddress(0, 0, 0, 0));
+}
+
+void WiFiEspClass::config(IPAddress ip, IPAddress dns_server, IPAddress gateway, IPAddress subnet)
+{
+	ipConfig(3, ip, gateway, subnet);
+	dnsConfig(1, dns_server, IPAddress(0, 0, 0, 0));
+}
+
+void WiFiEspClass::setDNS(IPAddress dns_server1)
+{
+	dnsConfig(1, dns_server1, IPAddress(0, 0, 0, 0));
+}
+
+void WiFiEspClass::setDNS(IPAddress dns_server1, IPAddress dns_server2)
+{
+	dnsConfig(2, dns_server1, dns_server2);
+}
+
+void WiFiEspClass::setHostname(const char* name)
+{
+	strncpy(_hostname, name, sizeof(_hostname) - 1);
+	_hostname[sizeof(_hostname) - 1] = 0;
+	if (esp32_spi_set_hostname((uint8_t *)_hostname) != 0)
+		LOGWARN(F("Failed to set hostname"));
+}
+
+void WiFiEspClass::ipConfig(uint8_t params, IPAddress local_ip, IPAddress gateway, IPAddress subnet)
+{
+	for (uint8_t i = 0; i < 4; i++)
+	{
+		_ipConfig[0][i] = local_ip[i];
+		_ipConfig[1][i] = gateway[i];
+		_ipConfig[2][i] = subnet[i];
+	}
+	_ipConfigParams = params;
+	_netValid = false;
+	if (esp32_spi_set_ip_config(params, _ipConfig[0], _ipConfig[1], _ipConfig[2]) != 0)
+		LOGWARN(F("Failed to set static IP"));
+}
+
+void WiFiEspClass::dnsConfig(uint8_t params, IPAddress dns_server1, IPAddress dns_server2)
+{
+	for (uint8_t i = 0; i < 4; i++)
+	{
+		_dnsConfig[0][i] = dns_server1[i];
+		_dnsConfig[1][i] = dns_server2[i];
+	}
+	_dnsConfigParams = params;
+	if (esp32_spi_set_dns_config(params, _dnsConfig[0], _dnsConfig[1]) != 0)
+		LOGWARN(F("Failed to set DNS servers"));
+}
+
+// a reset module is back on DHCP with its default name
+void WiFiEspClass::applyConfig()
+{
+	if (_hostname[0])
+		esp32_spi_set_hostname((uint8_t *)_hostname);
+	if (_ipConfigParams)
+		esp32_spi_set_ip_config(_ipConfigParams, _ipConfig[0], _ipConfig[1], _ipConfig[2]);
+	if (_dnsConfigParams)
+		esp32_spi_set_dns_config(_dnsConfigParams, _dnsConfig[0], _dnsConfig[1]);
 }
 
 void WiFiEspClass::configAP(IPAddress ip)
@@ -132,6 +497,11 @@ void WiFiEspClass::configAP(IPAddress ip)
 
 int WiFiEspClass::disconnect()
 {
+	// a deliberate disconnect is not reconnected by maintain()
+	_ssid[0] = 0;
+	_linkJoining = false;
+	_beginPending = false;
+	_netValid = false;
 	return esp32_spi_disconnect_from_AP();
 }
 
@@ -143,27 +513,47 @@ uint8_t* WiFiEspClass::macAddress(uint8_t* mac)
 	return mac;
 }
 
+// one GET_IPADDR_CMD answers localIP(), subnetMask() and gatewayIP() until
+// the connection state changes or the data is WIFIESP_NET_TTL_MS old
+const esp32_spi_net_t *WiFiEspClass::networkData()
+{
+	if (_netValid && millis() - _netTime < WIFIESP_NET_TTL_MS)
+		return &_net;
+
+	esp32_spi_net_t *net = esp32_spi_get_network_data();
+	if (net == NULL)
+		return NULL;
+
+	_net = *net;
+	_netValid = true;
+	_netTime = millis();
+	return &_net;
+}
+
 IPAddress WiFiEspClass::localIP()
 {
 	IPAddress ret;
-	esp32_spi_net_t *net = esp32_spi_get_network_data();
-	ret = net->localIp;
+	const esp32_spi_net_t *net = networkData();
+	if (net)
+		ret = net->localIp;
 	return ret;
 }
 
 IPAddress WiFiEspClass::subnetMask()
 {
 	IPAddress mask;
-	esp32_spi_net_t *net = esp32_spi_get_network_data();
-	mask = net->subnetMask;
+	const esp32_spi_net_t *net = networkData();
+	if (net)
+		mask = net->subnetMask;
 	return mask;
 }
 
 IPAddress WiFiEspClass::gatewayIP()
 {
 	IPAddress gw;
-	esp32_spi_net_t *net = esp32_spi_get_network_data();
-	gw = net->gatewayIp;
+	const esp32_spi_net_t *net = networkData();
+	if (net)
+		gw = net->gatewayIp;
 	return gw;
 }
 
@@ -175,9 +565,11 @@ char* WiFiEspClass::SSID()
 
 uint8_t* WiFiEspClass::BSSID(uint8_t* bssid)
 {
-	// TODO we don't need _bssid
-	uint8_t _bssid[6] = { 0, 0, 0, 0, 0, 0 };
-	memcpy(bssid, _bssid, WL_MAC_ADDR_LENGTH);
+	uint8_t *cur = esp32_spi_get_bssid();
+	if (cur)
+		memcpy(bssid, cur, WL_MAC_ADDR_LENGTH);
+	else
+		memset(bssid, 0, WL_MAC_ADDR_LENGTH);
 	return bssid;
 }
 
@@ -187,34 +579,234 @@ int32_t WiFiEspClass::RSSI()
 }
 
 
+// a background scan waited for; the ready pin is sampled without bus
+// traffic while the firmware scans
 int8_t WiFiEspClass::scanNetworks()
 {
-	aps_list = esp32_spi_scan_networks();
-	return aps_list->aps_num;
+	if (!scanNetworksAsync(NULL))
+		return 0;
+
+	int8_t n;
+	while ((n = scanPoll()) == WIFIESP_SCAN_RUNNING)
+		delay(1);
+
+	return n < 0 ? 0 : n;
+}
+
+int8_t WiFiEspClass::scanNetworksAsync(WiFiEspScanCallback callback)
+{
+	_scanCallback = callback;
+	_scanMerged = 0;
+	_scanFailed = false;
+	for (uint8_t i = 0; i < _apsNum; i++)
+		_apsSeen[i] = false;
+
+	if (esp32_spi_scan_async_start(_scanBuf, WL_NETWORKS_LIST_MAXNUM, 0) != 0)
+	{
+		_scanRunning = false;
+		_scanFailed = true;
+		return 0;
+	}
+
+	_scanRunning = true;
+	_scanStart = millis();
+	return 1;
+}
+
+int8_t WiFiEspClass::scanPoll()
+{
+	if (!_scanRunning)
+		return _scanFailed ? WIFIESP_SCAN_FAILED : _apsNum;
+
+	uint8_t done;
+	int32_t n = esp32_spi_scan_async_poll(&done);
+	if (n < 0)
+	{
+		_scanRunning = false;
+		_scanFailed = true;
+		return WIFIESP_SCAN_FAILED;
+	}
+
+	for (; _scanMerged < n; _scanMerged++)
+		scanMerge(&_scanBuf[_scanMerged], _scanMerged);
+
+	if (!done)
+	{
+		if (millis() - _scanStart < WIFIESP_SCAN_TIMEOUT_MS)
+			return WIFIESP_SCAN_RUNNING;
+
+		LOGERROR(F("Scan timed out"));
+		esp32_spi_scan_async_cancel();
+		_scanRunning = false;
+		_scanFailed = true;
+		return WIFIESP_SCAN_FAILED;
+	}
+
+	scanFinish();
+	return _apsNum;
+}
+
+int8_t WiFiEspClass::networkByRank(uint8_t rank)
+{
+	if (rank >= _apsNum)
+		return -1;
+	return _apsOrder[rank];
+}
+
+// update the entry for the same BSSID (SSID if the firmware gave none),
+// or add it, evicting the weakest network when the list is full; an SSID
+// reported twice by one scan keeps its stronger access point
+void WiFiEspClass::scanMerge(const esp32_spi_ap_t *ap, uint8_t idx)
+{
+	static const uint8_t noBssid[WL_MAC_ADDR_LENGTH] = { 0 };
+	bool byBssid = memcmp(ap->bssid, noBssid, WL_MAC_ADDR_LENGTH) != 0;
+	uint8_t i;
+
+	for (i = 0; i < _apsNum; i++)
+	{
+		if (byBssid ? memcmp(_aps[i].bssid, ap->bssid, WL_MAC_ADDR_LENGTH) == 0
+		            : strcmp((char *)_aps[i].ssid, (char *)ap->ssid) == 0)
+			break;
+	}
+
+	if (i < _apsNum && _apsSeen[i] && ap->rssi <= _aps[i].rssi)
+		return;
+
+	if (i == _apsNum)
+	{
+		if (_apsNum < WL_NETWORKS_LIST_MAXNUM)
+			_apsNum++;
+		else if (ap->rssi > _aps[_apsOrder[_apsNum - 1]].rssi)
+			i = _apsOrder[_apsNum - 1];
+		else
+			return;
+	}
+
+	_aps[i] = *ap;
+	_apsSeen[i] = true;
+	_apsIdx[i] = idx;
+	_apsExtras[i] = false;
+	scanSort();
+
+	if (_scanCallback)
+		_scanCallback(i);
+}
+
+// insertion sort, the list is at most WL_NETWORKS_LIST_MAXNUM long
+void WiFiEspClass::scanSort()
+{
+	for (uint8_t i = 0; i < _apsNum; i++)
+		_apsOrder[i] = i;
+
+	for (uint8_t i = 1; i < _apsNum; i++)
+	{
+		uint8_t item = _apsOrder[i];
+		int8_t j = i - 1;
+		while (j >= 0 && _aps[_apsOrder[j]].rssi < _aps[item].rssi)
+		{
+			_apsOrder[j + 1] = _apsOrder[j];
+			j--;
+		}
+		_apsOrder[j + 1] = item;
+	}
+}
+
+// networks the finished scan did not report are gone
+void WiFiEspClass::scanFinish()
+{
+	uint8_t n = 0;
+
+	for (uint8_t i = 0; i < _apsNum; i++)
+	{
+		if (!_apsSeen[i])
+			continue;
+		_aps[n] = _aps[i];
+		_apsSeen[n] = true;
+		_apsIdx[n] = _apsIdx[i];
+		_apsExtras[n] = _apsExtras[i];
+		n++;
+	}
+
+	_apsNum = n;
+	_scanRunning = false;
+	scanSort();
 }
 
 char* WiFiEspClass::SSID(uint8_t networkItem)
 {
-	esp32_spi_ap_t **aps = aps_list[networkItem].aps;
-	return (char *)(*aps)->ssid;
+	if (networkItem >= _apsNum)
+		return NULL;
+	return (char *)_aps[networkItem].ssid;
 }
 
 int32_t WiFiEspClass::RSSI(uint8_t networkItem)
 {
-	esp32_spi_ap_t **aps = aps_list[networkItem].aps;
-	return (*aps)->rssi;
+	if (networkItem >= _apsNum)
+		return 0;
+	return _aps[networkItem].rssi;
 }
 
 uint8_t WiFiEspClass::encryptionType(uint8_t networkItem)
 {
-	esp32_spi_ap_t **aps = aps_list[networkItem].aps;
-	return (*aps)->encr;
+	if (networkItem >= _apsNum)
+		return 0;
+	return _aps[networkItem].encr;
+}
+
+// BSSID and channel cost a round trip each per entry, so scans skip them
+// and they are fetched by the entry's index in the module's scan list;
+// entries a running scan has not reported again have no valid index yet
+bool WiFiEspClass::scanExtras(uint8_t networkItem)
+{
+	if (_apsExtras[networkItem])
+		return true;
+	if (!_apsSeen[networkItem])
+		return false;
+
+	esp32_spi_ap_t *ap = &_aps[networkItem];
+	if (esp32_spi_get_scan_extras(_apsIdx[networkItem], ap, ESP32_SPI_SCAN_BSSID | ESP32_SPI_SCAN_CHANNEL) != 0)
+	{
+		memset(ap->bssid, 0, WL_MAC_ADDR_LENGTH);
+		ap->channel = 0;
+		return false;
+	}
+
+	_apsExtras[networkItem] = true;
+	return true;
+}
+
+uint8_t* WiFiEspClass::BSSID(uint8_t networkItem, uint8_t* bssid)
+{
+	if (networkItem >= _apsNum)
+		memset(bssid, 0, WL_MAC_ADDR_LENGTH);
+	else
+	{
+		scanExtras(networkItem);
+		memcpy(bssid, _aps[networkItem].bssid, WL_MAC_ADDR_LENGTH);
+	}
+	return bssid;
+}
+
+uint8_t WiFiEspClass::channel(uint8_t networkItem)
+{
+	if (networkItem >= _apsNum)
+		return 0;
+	scanExtras(networkItem);
+	return _aps[networkItem].channel;
 }
 
 
 uint8_t WiFiEspClass::status()
 {
-	return esp32_spi_status();
+	uint8_t s = esp32_spi_status();
+
+	// reconnects and DHCP renewals show up as state changes
+	if (s != _netStatus)
+	{
+		_netStatus = s;
+		_netValid = false;
+	}
+	return s;
 }
 
 
@@ -225,11 +817,19 @@ uint8_t WiFiEspClass::status()
 
 void WiFiEspClass::reset(void)
 {
-#if USE_SOFT_SPI //SOFT
-	esp32_spi_init(10, 11, 12, 0);
-#else //HARD
-	esp32_spi_init(10, 11, 12, 1);
-#endif
+	_netValid = false;
+	if (!_initStarted)
+	{
+		init();
+		return;
+	}
+
+	// keep the pins and SPI mode initAsync() chose, only reboot the module;
+	// initPoll() applies the static configuration once it answers
+	esp32_spi_boot_start();
+	_initState = WIFIESP_INIT_RUNNING;
+	while (initPoll() == WIFIESP_INIT_RUNNING)
+		delay(1);
 }
 
 
@@ -238,6 +838,18 @@ bool WiFiEspClass::ping(const char *host)
 	return (esp32_spi_ping((uint8_t *)host, 1, 1) != -1);
 }
 
+uint32_t WiFiEspClass::trainSpiClock(uint32_t maxRate)
+{
+	uint32_t rate = esp32_spi_train_clock(maxRate);
+	LOGINFO1(F("SPI clock"), rate);
+	return rate;
+}
+
+uint32_t WiFiEspClass::setSoftSpiClock(uint32_t rate)
+{
+	return soft_spi_set_clk_rate(rate);
+}
+
 uint8_t WiFiEspClass::getFreeSocket()
 {
   // ESP Module assigns socket numbers in ascending order, so we will assign them in descending order
@@ -253,12 +865,659 @@ uint8_t WiFiEspClass::getFreeSocket()
 
 void WiFiEspClass::allocateSocket(uint8_t sock)
 {
+  // the server hands out the same socket on every poll, keep its pending data
+  if (_state[sock] != sock)
+  {
+    rxClear(sock);
+    _sockValid[sock] = false;
+  }
   _state[sock] = sock;
 }
 
+void WiFiEspClass::allocateServerSocket(uint8_t sock)
+{
+  allocateSocket(sock);
+  _listening[sock] = true;
+}
+
 void WiFiEspClass::releaseSocket(uint8_t sock)
 {
   _state[sock] = NA_STATE;
+  _listening[sock] = false;
+  _connecting[sock] = false;
+  _accepted[sock] = NA_STATE;
+  rxClear(sock);
+  _sockValid[sock] = false;
+  _rxOpportunistic[sock] = false;
+  _txLen[sock] = 0;
+  _txCoalesce[sock] = false;
+  _txChunk[sock] = WIFIESP_WRITE_CHUNK_SIZE;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Receive buffer
+////////////////////////////////////////////////////////////////////////////
+
+// bytes already fetched from the module and not yet consumed
+int WiFiEspClass::rxBuffered(uint8_t sock)
+{
+	if (sock >= MAX_SOCK_NUM)
+		return 0;
+	return _rxTail[sock] - _rxHead[sock];
+}
+
+// refill an empty buffer with a single GET_DATABUF_TCP_CMD
+// returns the number of buffered bytes, 0 if the module had nothing
+int WiFiEspClass::rxFill(uint8_t sock)
+{
+	if (sock >= MAX_SOCK_NUM)
+		return 0;
+	if (rxBuffered(sock))
+		return rxBuffered(sock);
+
+	int n = esp32_spi_socket_read(sock, _rxBuf[sock], WIFIESP_RX_BUFFER_SIZE);
+	socketConsumed(sock, n);
+	_rxHead[sock] = 0;
+	_rxTail[sock] = n > 0 ? n : 0;
+	return _rxTail[sock];
+}
+
+int WiFiEspClass::rxRead(uint8_t sock)
+{
+	if (!rxFill(sock))
+		return -1;
+	return _rxBuf[sock][_rxHead[sock]++];
+}
+
+int WiFiEspClass::rxPeek(uint8_t sock)
+{
+	if (!rxFill(sock))
+		return -1;
+	return _rxBuf[sock][_rxHead[sock]];
+}
+
+// copy out what is already buffered, never touches the bus
+int WiFiEspClass::rxRead(uint8_t sock, uint8_t *buf, size_t size)
+{
+	int n = rxBuffered(sock);
+	if (n > (int)size)
+		n = size;
+	if (n > 0)
+	{
+		memcpy(buf, &_rxBuf[sock][_rxHead[sock]], n);
+		_rxHead[sock] += n;
+	}
+	return n;
+}
+
+void WiFiEspClass::rxClear(uint8_t sock)
+{
+	if (sock >= MAX_SOCK_NUM)
+		return;
+	_rxHead[sock] = 0;
+	_rxTail[sock] = 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Socket state cache
+////////////////////////////////////////////////////////////////////////////
+
+void WiFiEspClass::setSocketStateWindow(unsigned long ms)
+{
+	_sockWindow = ms;
+}
+
+void WiFiEspClass::setDNSCacheTTL(uint32_t ttl, uint32_t negativeTtl)
+{
+	esp32_spi_dns_cache_config(ttl, negativeTtl);
+}
+
+int WiFiEspClass::resolveStart(const char* host)
+{
+	return esp32_spi_resolve_start((uint8_t *)host) == 0;
+}
+
+int WiFiEspClass::resolvePoll(IPAddress& result)
+{
+	uint8_t ip[4];
+	int ret = esp32_spi_resolve_poll(ip);
+
+	if (ret == 1)
+		return 0;
+	if (ret != 0)
+		return -1;
+
+	result = ip;
+	return 1;
+}
+
+void WiFiEspClass::refreshSocket(uint8_t sock)
+{
+	_sockAvail[sock] = esp32_spi_socket_available(sock);
+	_sockState[sock] = esp32_spi_socket_status(sock);
+	_sockTime[sock] = millis();
+	_sockValid[sock] = true;
+}
+
+// one pass over every connected socket in use; UDP sockets have no
+// connection state and polling a listener would accept its next client
+void WiFiEspClass::refreshSockets()
+{
+	for (uint8_t sock = 0; sock < MAX_SOCK_NUM; sock++)
+	{
+		if (_state[sock] != NA_STATE && _server_port[sock] == 0 && !_listening[sock])
+			refreshSocket(sock);
+	}
+}
+
+uint8_t WiFiEspClass::socketState(uint8_t sock)
+{
+	if (sock >= MAX_SOCK_NUM)
+		return SOCKET_CLOSED;
+	if (_listening[sock])
+		return SOCKET_LISTEN;
+
+	if (!_sockValid[sock] || millis() - _sockTime[sock] >= _sockWindow)
+	{
+		if (_sockWindow == 0)
+			refreshSocket(sock);
+		else
+			refreshSockets();
+
+		// not in use, so the sweep skipped it
+		if (!_sockValid[sock])
+			refreshSocket(sock);
+	}
+	return _sockState[sock];
+}
+
+int WiFiEspClass::poll(WiFiEspPollFd *fds, uint8_t count, unsigned long timeout)
+{
+	unsigned long start = millis();
+	unsigned long sleep = 1;
+
+	// a request waiting for its answer must go out first
+	for (uint8_t i = 0; i < count; i++)
+	{
+		uint8_t sock = fds[i].sock;
+		if (sock < MAX_SOCK_NUM && _state[sock] != NA_STATE && _server_port[sock] == 0
+			&& !_listening[sock] && (fds[i].events & WIFIESP_POLLIN))
+			txFlush(sock);
+	}
+
+	for (;;)
+	{
+		int ready = 0;
+
+		for (uint8_t i = 0; i < count; i++)
+		{
+			uint8_t sock = fds[i].sock;
+			fds[i].revents = 0;
+
+			if (sock >= MAX_SOCK_NUM || _state[sock] == NA_STATE)
+			{
+				fds[i].revents = WIFIESP_POLLHUP;
+			}
+			else if (fds[i].events & WIFIESP_POLLACCEPT)
+			{
+				// a server socket answers with the socket of a waiting client,
+				// which is then accepted: keep it for server.available()
+				if (_accepted[sock] == NA_STATE)
+				{
+					int client = esp32_spi_socket_available(sock);
+					if (client >= 0 && client < MAX_SOCK_NUM)
+					{
+						allocateSocket(client);
+						_accepted[sock] = client;
+					}
+				}
+				if (_accepted[sock] != NA_STATE)
+					fds[i].revents |= WIFIESP_POLLACCEPT;
+			}
+			else if (_server_port[sock])
+			{
+				// UDP sockets have no connection state
+				if (rxBuffered(sock) || esp32_spi_socket_available(sock) > 0)
+					fds[i].revents |= fds[i].events & WIFIESP_POLLIN;
+			}
+			else
+			{
+				// answered from the state cache, one sweep covers every fd
+				if (socketAvailable(sock) > 0)
+					fds[i].revents |= fds[i].events & WIFIESP_POLLIN;
+				else if (socketClosed(_sockState[sock]))
+					fds[i].revents |= WIFIESP_POLLHUP;
+			}
+
+			if (fds[i].revents)
+				ready++;
+		}
+
+		if (ready || millis() - start >= timeout)
+			return ready;
+
+		txFlushAllDue();
+
+		// nothing signals new data, so back off instead of hammering the bus
+		unsigned long left = timeout - (millis() - start);
+		delay(sleep < left ? sleep : left);
+		if (sleep < WIFIESP_POLL_MAX_SLEEP_MS)
+			sleep *= 2;
+	}
+}
+
+// closed, or on the way there; a connection still being set up is not
+bool WiFiEspClass::socketClosed(uint8_t state)
+{
+	switch (state)
+	{
+	case SOCKET_CLOSED:
+	case SOCKET_FIN_WAIT_1:
+	case SOCKET_FIN_WAIT_2:
+	case SOCKET_CLOSE_WAIT:
+	case SOCKET_CLOSING:
+	case SOCKET_LAST_ACK:
+	case SOCKET_TIME_WAIT:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// hand over the client poll() accepted on a listening socket, NA_STATE if none
+int16_t WiFiEspClass::takeAccepted(uint8_t sock)
+{
+	if (sock >= MAX_SOCK_NUM)
+		return NA_STATE;
+
+	int16_t client = _accepted[sock];
+	_accepted[sock] = NA_STATE;
+	return client;
+}
+
+// bytes waiting on the module as of the last refresh, plus what is buffered here
+int WiFiEspClass::socketAvailable(uint8_t sock)
+{
+	if (sock >= MAX_SOCK_NUM)
+		return 0;
+
+	socketState(sock);
+	return rxBuffered(sock) + (_sockAvail[sock] > 0 ? _sockAvail[sock] : 0);
+}
+
+// keep the cached count in step with reads, n is what a read returned
+void WiFiEspClass::socketConsumed(uint8_t sock, int n)
+{
+	if (sock >= MAX_SOCK_NUM)
+		return;
+
+	if (n <= 0 || n >= _sockAvail[sock])
+		_sockAvail[sock] = 0;
+	else
+		_sockAvail[sock] -= n;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Transmit buffer
+////////////////////////////////////////////////////////////////////////////
+
+// one SEND_DATA_TCP_CMD of at most one chunk, never waits for the firmware
+// returns the number of bytes accepted, 0 if the socket would block, -1 on error
+int WiFiEspClass::txSend(uint8_t sock, const uint8_t *buf, size_t size)
+{
+	uint16_t chunk = _txChunk[sock];
+	if (size > chunk)
+		size = chunk;
+
+	int32_t n = esp32_spi_socket_write(sock, (uint8_t *)buf, size);
+	if (n < 0)
+		return -1;
+
+	// nothing accepted: a full firmware buffer, or a dead connection
+	if (n == 0 && esp32_spi_socket_status(sock) != SOCKET_ESTABLISHED)
+		return -1;
+
+	// follow what the firmware takes per call, so big writes do not keep
+	// clocking out bytes it is going to refuse
+	if (n > 0 && (size_t)n < size)
+		_txChunk[sock] = n < WIFIESP_WRITE_CHUNK_MIN ? WIFIESP_WRITE_CHUNK_MIN : n;
+	else if ((size_t)n == chunk && chunk < WIFIESP_WRITE_CHUNK_SIZE)
+		_txChunk[sock] = chunk * 2 < WIFIESP_WRITE_CHUNK_SIZE ? chunk * 2 : WIFIESP_WRITE_CHUNK_SIZE;
+
+	return n;
+}
+
+// queue data for the socket, sending it once the buffer fills up or lingers
+// returns the number of bytes taken, 0 if the socket would block, -1 on error
+int WiFiEspClass::txWrite(uint8_t sock, const uint8_t *buf, size_t size)
+{
+	int pending = _txLen[sock];
+
+	if (pending && (!_txCoalesce[sock] || pending + size > WIFIESP_TX_BUFFER_SIZE))
+	{
+		pending = txFlush(sock);
+		if (pending < 0)
+			return -1;
+	}
+
+	// large writes gain nothing from a copy, but must not overtake queued data
+	if (!_txCoalesce[sock] || size >= WIFIESP_TX_BUFFER_SIZE)
+	{
+		if (pending)
+			return 0;
+		return txSend(sock, buf, size);
+	}
+
+	if (size > (size_t)(WIFIESP_TX_BUFFER_SIZE - pending))
+		size = WIFIESP_TX_BUFFER_SIZE - pending;
+	if (size == 0)
+		return 0;
+
+	if (pending == 0)
+		_txTime[sock] = millis();
+	memcpy(&_txBuf[sock][pending], buf, size);
+	_txLen[sock] += size;
+
+	if (_txLen[sock] == WIFIESP_TX_BUFFER_SIZE ? txFlush(sock) < 0 : txFlushDue(sock) < 0)
+		return -1;
+	return size;
+}
+
+// try once to send the queued data, keeping whatever the firmware refused
+// returns the number of bytes still queued, or -1 on error
+int WiFiEspClass::txFlush(uint8_t sock)
+{
+	if (sock >= MAX_SOCK_NUM || _txLen[sock] == 0)
+		return 0;
+
+	int n = txSend(sock, _txBuf[sock], _txLen[sock]);
+	if (n < 0)
+	{
+		_txLen[sock] = 0;
+		return -1;
+	}
+
+	_txLen[sock] -= n;
+	if (n && _txLen[sock])
+		memmove(_txBuf[sock], &_txBuf[sock][n], _txLen[sock]);
+	return _txLen[sock];
+}
+
+// send coalesced data that has waited longer than WIFIESP_TX_LINGER_MS
+int WiFiEspClass::txFlushDue(uint8_t sock)
+{
+	if (sock >= MAX_SOCK_NUM || _txLen[sock] == 0)
+		return 0;
+	if (millis() - _txTime[sock] < WIFIESP_TX_LINGER_MS)
+		return _txLen[sock];
+	return txFlush(sock);
+}
+
+// send coalesced data that has lingered long enough on every socket
+void WiFiEspClass::txFlushAllDue()
+{
+	for (uint8_t sock = 0; sock < MAX_SOCK_NUM; sock++)
+	{
+		if (_state[sock] != NA_STATE)
+			txFlushDue(sock);
+	}
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////
+// Client sockets, shared by WiFiEspClient and WiFiEspSSLClient
+////////////////////////////////////////////////////////////////////////////
+
+// open a socket without waiting for the handshake, NO_SOCKET_AVAIL on failure
+uint8_t WiFiEspClass::sockConnectStart(uint8_t *dest, uint8_t destType, uint16_t port, uint8_t protMode, unsigned long timeout)
+{
+	uint8_t sock = getFreeSocket();
+	if (sock == NO_SOCKET_AVAIL)
+	{
+		LOGERROR(F("No socket available"));
+		return NO_SOCKET_AVAIL;
+	}
+
+	if (esp32_spi_socket_open(sock, dest, destType, port, (esp32_socket_mode_enum_t)protMode))
+		return NO_SOCKET_AVAIL;
+
+	allocateSocket(sock);
+	_connecting[sock] = true;
+	_connStart[sock] = _connPolled[sock] = millis();
+	_connTimeout[sock] = timeout;
+	return sock;
+}
+
+// status checks are paced to ESP32_SPI_CONNECT_POLL_MS, polling faster
+// costs nothing on the bus
+// 1 connected, 0 still connecting, -1 failed or timed out
+int WiFiEspClass::sockConnectPoll(uint8_t sock)
+{
+	if (!_connecting[sock])
+		return 1;
+
+	unsigned long now = millis();
+	if (now - _connPolled[sock] < ESP32_SPI_CONNECT_POLL_MS)
+		return 0;
+	_connPolled[sock] = now;
+
+	int8_t r = esp32_spi_socket_connect_poll(sock);
+	if (r == 0)
+	{
+		_connecting[sock] = false;
+		return 1;
+	}
+
+	if (r < 0 || now - _connStart[sock] >= _connTimeout[sock])
+	{
+		LOGERROR1(F("Connect failed on socket"), sock);
+		return -1;
+	}
+	return 0;
+}
+
+// resend the tail the firmware did not take, giving up after timeout
+// without progress rather than stalling the caller indefinitely
+size_t WiFiEspClass::sockWrite(uint8_t sock, const uint8_t *buf, size_t size, unsigned long timeout, bool &error)
+{
+	size_t sent = 0;
+	unsigned long start = millis();
+	while (sent < size)
+	{
+		int n = sockWriteSome(sock, buf + sent, size - sent);
+		if (n < 0)
+		{
+			error = true;
+			break;
+		}
+
+		if (n == 0)
+		{
+			if (millis() - start >= timeout)
+			{
+				error = true;
+				LOGWARN1(F("Write timed out on socket"), sock);
+				break;
+			}
+			delay(1);
+			continue;
+		}
+
+		sent += n;
+		start = millis();
+	}
+
+	return sent;
+}
+
+// large payloads are split by sockWrite(), the producer only sizes its reads
+size_t WiFiEspClass::sockWrite(uint8_t sock, WiFiEspWriteProducer producer, void *arg, unsigned long timeout, bool &error)
+{
+	size_t total = 0;
+	size_t len;
+	while ((len = producer(_writeChunk, WIFIESP_WRITE_CHUNK_SIZE, arg)) > 0)
+	{
+		size_t n = sockWrite(sock, _writeChunk, len, timeout, error);
+		total += n;
+		if (n < len)
+			break;
+	}
+
+	return total;
+}
+
+int WiFiEspClass::sockWriteSome(uint8_t sock, const uint8_t *buf, size_t size)
+{
+	if (size == 0)
+		return 0;
+
+	int n = txWrite(sock, buf, size);
+	if (n < 0)
+		LOGERROR1(F("Failed to write to socket"), sock);
+	return n;
+}
+
+int WiFiEspClass::sockAvailable(uint8_t sock)
+{
+	// whoever polls for input is usually waiting on a reply to what was queued
+	txFlush(sock);
+
+	int bytes = rxBuffered(sock);
+	if (bytes > 0)
+		return bytes;
+
+	// fetch the data itself instead of asking how much there is,
+	// the read that usually follows is then served locally
+	if (_rxOpportunistic[sock])
+		return rxFill(sock);
+
+	bytes = esp32_spi_socket_available(sock);
+	_sockAvail[sock] = bytes;
+	return bytes > 0 ? bytes : 0;
+}
+
+// single bytes are served from the socket receive buffer, which is
+// refilled with one bulk transfer when it runs dry
+int WiFiEspClass::sockRead(uint8_t sock)
+{
+	txFlush(sock);
+	return rxRead(sock);
+}
+
+// returns up to size bytes, 0 if nothing has arrived yet, -1 once the
+// connection is closed and drained
+int WiFiEspClass::sockRead(uint8_t sock, uint8_t *buf, size_t size)
+{
+	if (size == 0)
+		return 0;
+	txFlush(sock);
+
+	// drain buffered bytes first, they precede anything still on the module
+	int n = rxRead(sock, buf, size);
+	if (n > 0)
+		return n;
+
+	n = esp32_spi_socket_read(sock, buf, size > 0xffff ? 0xffff : size);
+	if (n < 0)
+		return -1;
+	socketConsumed(sock, n);
+
+	// only an empty reply costs the extra status check, skipped in
+	// opportunistic mode where closing is left to connected()
+	if (n == 0 && !_rxOpportunistic[sock]
+		&& esp32_spi_socket_status(sock) != SOCKET_ESTABLISHED)
+		return -1;
+
+	return n;
+}
+
+int WiFiEspClass::sockReadFully(uint8_t sock, uint8_t *buf, size_t size, unsigned long deadline)
+{
+	size_t got = 0;
+	while (got < size)
+	{
+		int n = sockRead(sock, buf + got, size - got);
+		if (n < 0)
+			return got ? (int)got : -1;
+
+		if (n == 0)
+		{
+			if ((long)(millis() - deadline) >= 0)
+				break;
+			delay(1);
+			continue;
+		}
+
+		got += n;
+	}
+
+	return got;
+}
+
+int WiFiEspClass::sockPeek(uint8_t sock)
+{
+	txFlush(sock);
+	return rxPeek(sock);
+}
+
+// false if output was still pending after timeout
+bool WiFiEspClass::sockFlush(uint8_t sock, unsigned long timeout)
+{
+	int pending;
+	unsigned long start = millis();
+	while ((pending = txFlush(sock)) > 0 && millis() - start < timeout)
+		delay(1);
+
+	if (pending)
+	{
+		LOGERROR1(F("Failed to write to socket"), sock);
+		return false;
+	}
+	return true;
+}
+
+bool WiFiEspClass::sockSetNoDelay(uint8_t sock, bool nodelay, unsigned long timeout)
+{
+	bool ok = true;
+	if (nodelay)
+		ok = sockFlush(sock, timeout);
+	_txCoalesce[sock] = !nodelay;
+	return ok;
+}
+
+void WiFiEspClass::sockSetOpportunistic(uint8_t sock, bool enable)
+{
+	_rxOpportunistic[sock] = enable;
+}
+
+// flush, close and release; false if pending output could not be sent
+bool WiFiEspClass::sockStop(uint8_t sock, unsigned long timeout)
+{
+	LOGINFO1(F("Disconnecting "), sock);
+
+	bool ok = sockFlush(sock, timeout);
+	esp32_spi_socket_close(sock);
+	releaseSocket(sock);
+	return ok;
+}
+
+// answered from the socket state cache, see setSocketStateWindow();
+// a socket found closed is released
+uint8_t WiFiEspClass::sockStatus(uint8_t sock)
+{
+	// still handshaking, see sockConnectPoll()
+	if (_connecting[sock])
+		return SOCKET_SYN_SENT;
+
+	if (socketAvailable(sock) > 0 || socketState(sock) == SOCKET_ESTABLISHED)
+		return SOCKET_ESTABLISHED;
+
+	releaseSocket(sock);
+	return SOCKET_CLOSED;
 }
 
 
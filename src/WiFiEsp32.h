@@ -45,7 +45,9 @@ along with The Arduino WiFiEsp library.  If not, see
 #define WL_IPV4_LENGTH 4
 
 // Maximum size of a SSID list
+#ifndef WL_NETWORKS_LIST_MAXNUM
 #define WL_NETWORKS_LIST_MAXNUM	10
+#endif
 
 // Maxmium number of socket
 #define	MAX_SOCK_NUM		4
@@ -64,6 +66,108 @@ along with The Arduino WiFiEsp library.  If not, see
 // maximum size of AT command
 #define CMD_BUFFER_SIZE 200
 
+// Size of the per-socket receive buffer, refilled in bulk with GET_DATABUF_TCP_CMD
+#ifndef WIFIESP_RX_BUFFER_SIZE
+#define WIFIESP_RX_BUFFER_SIZE 256
+#endif
+
+// Size of the per-socket transmit buffer used when write coalescing is enabled
+#ifndef WIFIESP_TX_BUFFER_SIZE
+#define WIFIESP_TX_BUFFER_SIZE 256
+#endif
+
+// Coalesced data older than this (ms) is sent by the next write/connected() on the
+// socket, or by the next WiFi.poll()/WiFi.maintain()
+#ifndef WIFIESP_TX_LINGER_MS
+#define WIFIESP_TX_LINGER_MS 5
+#endif
+
+// Largest payload sent in one SEND_DATA_TCP_CMD, it must fit one SPI frame.
+// The chunk shrinks towards what the firmware actually accepts per call,
+// but never below WIFIESP_WRITE_CHUNK_MIN
+#ifndef WIFIESP_WRITE_CHUNK_SIZE
+#define WIFIESP_WRITE_CHUNK_SIZE SPI_MAX_DMA_LEN
+#endif
+#ifndef WIFIESP_WRITE_CHUNK_MIN
+#define WIFIESP_WRITE_CHUNK_MIN 512
+#endif
+
+// Default time (ms) a socket state sweep answers status queries before the next one
+#ifndef WIFIESP_SOCK_STATE_WINDOW_MS
+#define WIFIESP_SOCK_STATE_WINDOW_MS 20
+#endif
+
+// Longest time (ms) localIP(), subnetMask() and gatewayIP() answer from the
+// last address query, covers DHCP renewals that leave the status unchanged
+#ifndef WIFIESP_NET_TTL_MS
+#define WIFIESP_NET_TTL_MS 5000
+#endif
+
+// WiFi.poll() events
+#define WIFIESP_POLLIN		0x01	// data to read
+#define WIFIESP_POLLACCEPT	0x02	// server socket accepted a client, collect it with server.available()
+#define WIFIESP_POLLHUP		0x04	// connection closed or closing, always reported
+
+// Longest sleep (ms) between two WiFi.poll() sweeps
+#ifndef WIFIESP_POLL_MAX_SLEEP_MS
+#define WIFIESP_POLL_MAX_SLEEP_MS 16
+#endif
+
+// WiFi.scanPoll() results other than a network count
+#define WIFIESP_SCAN_RUNNING	-1
+#define WIFIESP_SCAN_FAILED		-2
+
+// A scan not finished after this long (ms) is reported as failed
+#ifndef WIFIESP_SCAN_TIMEOUT_MS
+#define WIFIESP_SCAN_TIMEOUT_MS 15000
+#endif
+
+// called by background scans with the item index of each network as it is found or updated
+typedef void (*WiFiEspScanCallback)(uint8_t networkItem);
+
+// WiFi.initPoll() results
+#define WIFIESP_INIT_READY		0
+#define WIFIESP_INIT_RUNNING	-1
+#define WIFIESP_INIT_FAILED		-2
+
+// Join status is checked at most this often (ms) by WiFi.beginPoll()
+#ifndef WIFIESP_BEGIN_POLL_MS
+#define WIFIESP_BEGIN_POLL_MS 20
+#endif
+
+// A join started by WiFi.beginAsync() not finished after this long (ms) fails
+#ifndef WIFIESP_BEGIN_TIMEOUT_MS
+#define WIFIESP_BEGIN_TIMEOUT_MS 10000
+#endif
+
+// Link state is checked at most this often (ms) by WiFi.maintain()
+#ifndef WIFIESP_LINK_POLL_MS
+#define WIFIESP_LINK_POLL_MS 250
+#endif
+
+// Reconnect backoff bounds (ms), doubled after every failed attempt plus up to 25% jitter
+#ifndef WIFIESP_RECONNECT_MIN_MS
+#define WIFIESP_RECONNECT_MIN_MS 500
+#endif
+#ifndef WIFIESP_RECONNECT_MAX_MS
+#define WIFIESP_RECONNECT_MAX_MS 30000
+#endif
+
+// A reconnect attempt not finished after this long (ms) counts as failed
+#ifndef WIFIESP_RECONNECT_ATTEMPT_MS
+#define WIFIESP_RECONNECT_ATTEMPT_MS 10000
+#endif
+
+// called by WiFi.maintain() with the new status whenever the link state changes
+typedef void (*WiFiEspLinkCallback)(uint8_t status);
+
+typedef struct
+{
+	uint8_t sock;		// from getSocket() of a client, UDP or server object
+	uint8_t events;		// WIFIESP_POLL* flags to wait for
+	uint8_t revents;	// WIFIESP_POLL* flags that are ready
+} WiFiEspPollFd;
+
 
 #define HAVE_HWSERIAL1
 
@@ -87,6 +191,22 @@ public:
 	static void init(void);
 	static void init(SPIClass& spi);
 
+	/**
+	* Start initializing the ESP module and return at once, so other hardware
+	* can be brought up while it boots. Drive it with initPoll(), or with
+	* beginPoll() after beginAsync().
+	*/
+	static void initAsync(void);
+	static void initAsync(SPIClass& spi);
+
+	/**
+	* Advance the module boot without blocking; returns as soon as the
+	* firmware answers instead of after a fixed delay.
+	*
+	* return: WIFIESP_INIT_READY, WIFIESP_INIT_RUNNING or WIFIESP_INIT_FAILED
+	*/
+	static int8_t initPoll();
+
 
 	/**
 	* Get firmware version
@@ -111,29 +231,76 @@ public:
 	*/
 	int begin(const char* ssid, const char* passphrase);
 
+	/**
+	* Start joining a network and return at once, drive it with beginPoll()
+	* or maintain(). May be called while initAsync() is still booting the module.
+	*/
+	void beginAsync(const char* ssid, const char* passphrase);
 
 	/**
-	* Change Ip configuration settings disabling the DHCP client
+	* Advance initAsync() and beginAsync(), at most one module round trip per call.
 	*
-	* param local_ip:	Static ip configuration
+	* return: WL_IDLE_STATUS while in progress, then WL_CONNECTED,
+	*	WL_CONNECT_FAILED, or WL_NO_SHIELD if the module did not boot
 	*/
-	void config(IPAddress local_ip);
+	uint8_t beginPoll();
 
+	/**
+	* Keep the link up: call it from loop(). Checks the link state at most every
+	* WIFIESP_LINK_POLL_MS and, with auto reconnect on, rejoins the network given
+	* to begin() after a drop, backing off exponentially with jitter between attempts.
+	*
+	* return: the current status
+	*/
+	uint8_t maintain();
 
-	// NOT IMPLEMENTED
-	//void config(IPAddress local_ip, IPAddress dns_server);
+	/**
+	* Enable or disable reconnecting from maintain(), enabled by default
+	*/
+	void setAutoReconnect(bool enable);
 
-	// NOT IMPLEMENTED
-	//void config(IPAddress local_ip, IPAddress dns_server, IPAddress gateway);
+	/**
+	* Call callback with the new status whenever maintain() sees the link state change
+	*/
+	void onLinkChange(WiFiEspLinkCallback callback);
 
-	// NOT IMPLEMENTED
-	//void config(IPAddress local_ip, IPAddress dns_server, IPAddress gateway, IPAddress subnet);
+	/**
+	* BSSID and channel of the access point of the last successful connection
+	* (channel is 0 unless the access point was in the last scan)
+	*/
+	uint8_t* lastBSSID(uint8_t* bssid);
+	uint8_t lastChannel();
 
-	// NOT IMPLEMENTED
-	//void setDNS(IPAddress dns_server1);
 
-	// NOT IMPLEMENTED
-	//void setDNS(IPAddress dns_server1, IPAddress dns_server2);
+	/**
+	* Change Ip configuration settings disabling the DHCP client.
+	* Call before begin(): the station then comes up without waiting on DHCP.
+	* The gateway defaults to x.x.x.1 of local_ip and the subnet to 255.255.255.0,
+	* the DNS server to the gateway.
+	*
+	* param local_ip:	Static ip configuration
+	* param dns_server:	IP configuration for DNS server 1
+	* param gateway:	Static gateway configuration
+	* param subnet:		Static Subnet mask
+	*/
+	void config(IPAddress local_ip);
+	void config(IPAddress local_ip, IPAddress dns_server);
+	void config(IPAddress local_ip, IPAddress dns_server, IPAddress gateway);
+	void config(IPAddress local_ip, IPAddress dns_server, IPAddress gateway, IPAddress subnet);
+
+	/**
+	* Change DNS Ip configuration
+	*
+	* param dns_server1:	ip configuration for DNS server 1
+	* param dns_server2:	ip configuration for DNS server 2
+	*/
+	void setDNS(IPAddress dns_server1);
+	void setDNS(IPAddress dns_server1, IPAddress dns_server2);
+
+	/**
+	* Set the host name sent to the DHCP server, call before begin()
+	*/
+	void setHostname(const char* name);
 
 	/**
 	* Disconnect from the network
@@ -246,6 +413,55 @@ public:
      */
     int32_t RSSI(uint8_t networkItem);
 
+    /*
+     * Return the BSSID of the networks discovered during the scanNetworks
+     *
+     * param networkItem: specify from which network item want to get the information
+     * param bssid: array of WL_MAC_ADDR_LENGTH bytes to fill
+     *
+     * return: bssid, all zero if the item does not exist
+     *
+     * Fetched from the module on first use, scans only collect SSID, RSSI and encryption.
+     */
+    uint8_t* BSSID(uint8_t networkItem, uint8_t* bssid);
+
+    /*
+     * Return the channel of the networks discovered during the scanNetworks
+     *
+     * param networkItem: specify from which network item want to get the information
+     *
+     * return: channel of the specified item, 0 if unknown
+     *
+     * Fetched from the module on first use, like BSSID().
+     */
+    uint8_t channel(uint8_t networkItem);
+
+    /*
+     * Start a background scan and return at once, drive it with scanPoll().
+     * Results are merged into the list read by SSID(i), RSSI(i), ... as they arrive,
+     * one entry per SSID keeping its strongest access point;
+     * networks missing from a finished scan are dropped.
+     *
+     * param callback: called with the item index of every network found or updated, may be NULL
+     *
+     * return: 1 if the scan started, 0 if not
+     */
+    int8_t scanNetworksAsync(WiFiEspScanCallback callback = NULL);
+
+    /*
+     * Advance a background scan, at most one module round trip per call.
+     *
+     * return: WIFIESP_SCAN_RUNNING, WIFIESP_SCAN_FAILED, or the number of networks once complete
+     */
+    int8_t scanPoll();
+
+    /*
+     * Return the item index of the network with the given signal rank, 0 being the strongest.
+     *
+     * return: item index for SSID(i), RSSI(i), ..., -1 if there are fewer networks
+     */
+    int8_t networkByRank(uint8_t rank);
+
 
 	// NOT IMPLEMENTED
 	//int hostByName(const char* aHostname, IPAddress& aResult);
@@ -293,6 +509,62 @@ public:
 	*/
 	bool ping(const char *host);
 
+	/**
+	* Find the fastest reliable hard SPI clock up to maxRate.
+	* Framing errors at runtime step the clock back down automatically, and a
+	* run of clean replies steps it back up, never past the trained clock.
+	*
+	* return: the trained clock in Hz, 0 with soft SPI or if the module does not answer
+	*/
+	uint32_t trainSpiClock(uint32_t maxRate = 32000000);
+
+	/**
+	* Set the soft SPI clock, 0 runs as fast as the GPIOs allow (the default).
+	*
+	* return: the clock in Hz the cycle counter can actually hit
+	*/
+	uint32_t setSoftSpiClock(uint32_t rate);
+
+	/**
+	* Set how long (ms) cached socket states answer connected()/status() before
+	* all open sockets are swept again. 0 queries the module on every call.
+	*/
+	void setSocketStateWindow(unsigned long ms);
+
+	/**
+	* Set how long (s) resolved host names, and names that failed to resolve,
+	* are cached. 0 disables caching of that kind. Clears the cache.
+	*/
+	void setDNSCacheTTL(uint32_t ttl, uint32_t negativeTtl);
+
+	/**
+	* Start resolving a host name and return without waiting for the answer.
+	* Only one lookup is outstanding at a time, starting another drops the first.
+	* Any other module command issued meanwhile waits for the lookup to finish.
+	*
+	* return: 1 if the lookup was started, 0 on error
+	*/
+	int resolveStart(const char* host);
+
+	/**
+	* Check on the lookup started by resolveStart().
+	*
+	* return: 1 with result set, 0 while pending, -1 if the name did not resolve
+	*/
+	int resolvePoll(IPAddress& result);
+
+	/**
+	* Wait until one of the sockets is ready or timeout (ms) expires.
+	* All sockets are checked in one sweep, then re-checked with a growing sleep.
+	*
+	* param fds: sockets and the events to wait for, revents is filled in
+	* param count: number of entries in fds
+	* param timeout: 0 checks once without waiting
+	*
+	* return: number of entries with revents set, 0 on timeout
+	*/
+	int poll(WiFiEspPollFd *fds, uint8_t count, unsigned long timeout);
+
 
 	friend class WiFiEspClient;
 	friend class WiFiEspSSLClient;
@@ -302,8 +574,146 @@ public:
 private:
 	static uint8_t getFreeSocket();
 	static void allocateSocket(uint8_t sock);
+	static void allocateServerSocket(uint8_t sock);
 	static void releaseSocket(uint8_t sock);
 
+	// listening sockets: AVAIL_DATA_TCP_CMD on them accepts a client, so the
+	// socket state cache must never query them
+	static bool _listening[MAX_SOCK_NUM];
+	// client a poll() accepted on a listening socket, kept for server.available()
+	static int16_t _accepted[MAX_SOCK_NUM];
+
+	static int16_t takeAccepted(uint8_t sock);
+	static bool socketClosed(uint8_t state);
+
+	// per-socket receive buffer shared by every client object on that socket
+	static uint8_t _rxBuf[MAX_SOCK_NUM][WIFIESP_RX_BUFFER_SIZE];
+	static uint16_t _rxHead[MAX_SOCK_NUM];
+	static uint16_t _rxTail[MAX_SOCK_NUM];
+
+	static int rxBuffered(uint8_t sock);
+	static int rxFill(uint8_t sock);
+	static int rxRead(uint8_t sock);
+	static int rxPeek(uint8_t sock);
+	static int rxRead(uint8_t sock, uint8_t *buf, size_t size);
+	static void rxClear(uint8_t sock);
+	static bool _rxOpportunistic[MAX_SOCK_NUM];
+
+	// per-socket transmit buffer, only used when coalescing is enabled
+	static uint8_t _txBuf[MAX_SOCK_NUM][WIFIESP_TX_BUFFER_SIZE];
+	static uint16_t _txLen[MAX_SOCK_NUM];
+	static unsigned long _txTime[MAX_SOCK_NUM];
+	static bool _txCoalesce[MAX_SOCK_NUM];
+	static uint16_t _txChunk[MAX_SOCK_NUM];
+	// staging buffer for producer writes, one is enough since the bus is single threaded
+	static uint8_t _writeChunk[WIFIESP_WRITE_CHUNK_SIZE];
+
+	// client socket operations shared by WiFiEspClient and WiFiEspSSLClient;
+	// write failures are returned through error so each client sets its own flag
+	static bool _connecting[MAX_SOCK_NUM];		// connectAsync() handshake in progress
+	static unsigned long _connStart[MAX_SOCK_NUM];
+	static unsigned long _connPolled[MAX_SOCK_NUM];	// last status check
+	static unsigned long _connTimeout[MAX_SOCK_NUM];
+
+	static uint8_t sockConnectStart(uint8_t *dest, uint8_t destType, uint16_t port, uint8_t protMode, unsigned long timeout);
+	static int sockConnectPoll(uint8_t sock);
+	static size_t sockWrite(uint8_t sock, const uint8_t *buf, size_t size, unsigned long timeout, bool &error);
+	static size_t sockWrite(uint8_t sock, WiFiEspWriteProducer producer, void *arg, unsigned long timeout, bool &error);
+	static int sockWriteSome(uint8_t sock, const uint8_t *buf, size_t size);
+	static int sockAvailable(uint8_t sock);
+	static int sockRead(uint8_t sock);
+	static int sockRead(uint8_t sock, uint8_t *buf, size_t size);
+	static int sockReadFully(uint8_t sock, uint8_t *buf, size_t size, unsigned long deadline);
+	static int sockPeek(uint8_t sock);
+	static bool sockFlush(uint8_t sock, unsigned long timeout);
+	static bool sockSetNoDelay(uint8_t sock, bool nodelay, unsigned long timeout);
+	static void sockSetOpportunistic(uint8_t sock, bool enable);
+	static bool sockStop(uint8_t sock, unsigned long timeout);
+	static uint8_t sockStatus(uint8_t sock);
+
+	static int txSend(uint8_t sock, const uint8_t *buf, size_t size);
+	static int txWrite(uint8_t sock, const uint8_t *buf, size_t size);
+	static int txFlush(uint8_t sock);
+	static int txFlushDue(uint8_t sock);
+	static void txFlushAllDue();
+
+	// addresses from the last GET_IPADDR_CMD, dropped when the connection
+	// state changes or after WIFIESP_NET_TTL_MS
+	static esp32_spi_net_t _net;
+	static bool _netValid;
+	static unsigned long _netTime;
+	static uint8_t _netStatus;
+
+	static const esp32_spi_net_t *networkData();
+
+	// static configuration, applied again after a module reset
+	static uint8_t _ipConfig[3][4];
+	static uint8_t _ipConfigParams;		// leading _ipConfig entries that were given (1-3), 0 if none
+	static uint8_t _dnsConfig[2][4];
+	static uint8_t _dnsConfigParams;
+	static char _hostname[ESP32_SPI_HOSTNAME_MAX + 1];
+
+	static void ipConfig(uint8_t params, IPAddress local_ip, IPAddress gateway, IPAddress subnet);
+	static void dnsConfig(uint8_t params, IPAddress dns_server1, IPAddress dns_server2);
+	static void applyConfig();
+
+	// connection manager, see maintain()
+	static char _ssid[33];
+	static char _pass[65];
+	static bool _autoReconnect;
+	static uint8_t _linkStatus;
+	static bool _linkJoining;
+	static unsigned long _linkPolled;
+	static unsigned long _linkRetryAt;
+	static unsigned long _linkJoinStart;
+	static unsigned long _linkBackoff;
+	static uint8_t _lastBssid[WL_MAC_ADDR_LENGTH];
+	static uint8_t _lastChannel;
+	static WiFiEspLinkCallback _linkCallback;
+
+	static int8_t _initState;
+	static bool _initStarted;
+	static bool _beginPending;
+
+	static void linkCredentials(const char* ssid, const char* passphrase);
+	static void linkUp();
+	static void linkRetryLater(unsigned long now);
+
+	// networks from the last scans, _apsOrder sorts them by RSSI
+	static esp32_spi_ap_t _aps[WL_NETWORKS_LIST_MAXNUM];
+	static uint8_t _apsNum;
+	static uint8_t _apsOrder[WL_NETWORKS_LIST_MAXNUM];
+	static bool _apsSeen[WL_NETWORKS_LIST_MAXNUM];
+	// index in the module's scan list, BSSID and channel are fetched on demand
+	static uint8_t _apsIdx[WL_NETWORKS_LIST_MAXNUM];
+	static bool _apsExtras[WL_NETWORKS_LIST_MAXNUM];
+
+	// background scan, filled by the driver and merged into _aps
+	static esp32_spi_ap_t _scanBuf[WL_NETWORKS_LIST_MAXNUM];
+	static uint8_t _scanMerged;
+	static bool _scanRunning;
+	static bool _scanFailed;
+	static unsigned long _scanStart;
+	static WiFiEspScanCallback _scanCallback;
+
+	static void scanMerge(const esp32_spi_ap_t *ap, uint8_t idx);
+	static bool scanExtras(uint8_t networkItem);
+	static void scanSort();
+	static void scanFinish();
+
+	// cached socket state, refreshed for all open sockets at once
+	static uint8_t _sockState[MAX_SOCK_NUM];
+	static int _sockAvail[MAX_SOCK_NUM];
+	static bool _sockValid[MAX_SOCK_NUM];
+	static unsigned long _sockTime[MAX_SOCK_NUM];
+	static unsigned long _sockWindow;
+
+	static void refreshSocket(uint8_t sock);
+	static void refreshSockets();
+	static uint8_t socketState(uint8_t sock);
+	static int socketAvailable(uint8_t sock);
+	static void socketConsumed(uint8_t sock, int n);
+
 	static uint8_t espMode;
 	static SPIClass& spi_;
 };
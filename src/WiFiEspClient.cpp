@@ -42,14 +42,14 @@ WiFiEspClient::WiFiEspClient(uint8_t sock) : _sock(sock)
 // this is very slow on ESP
 size_t WiFiEspClient::print(const __FlashStringHelper *ifsh)
 {
-	printFSH(ifsh, false);
+	return printFSH(ifsh, false);
 }
 
 // if we do override this, the standard println will call the print
 // method twice
 size_t WiFiEspClient::println(const __FlashStringHelper *ifsh)
 {
-	printFSH(ifsh, true);
+	return printFSH(ifsh, true);
 }
 
 
@@ -129,6 +129,49 @@ int WiFiEspClient::connect(const char* host, uint16_t port, uint8_t protMode)
 }
 
 
+int WiFiEspClient::connectAsync(IPAddress ip, uint16_t port, unsigned long timeout)
+{
+	uint8_t addr[4] = { ip[0], ip[1], ip[2], ip[3] };
+	return connectStart(addr, 0, port, TCP_MODE, timeout);
+}
+
+int WiFiEspClient::connectAsync(const char* host, uint16_t port, unsigned long timeout)
+{
+	LOGINFO1(F("Connecting to"), host);
+
+	// the firmware only takes host names for TLS, resolve here
+	uint8_t ip[4];
+	if (esp32_spi_get_host_by_name((uint8_t *)host, ip))
+		return 0;
+	return connectStart(ip, 0, port, TCP_MODE, timeout);
+}
+
+/* Private method */
+int WiFiEspClient::connectStart(uint8_t *dest, uint8_t destType, uint16_t port, uint8_t protMode, unsigned long timeout)
+{
+	if (_sock != 255)
+		stop();
+
+	_sock = WiFiEspClass::sockConnectStart(dest, destType, port, protMode, timeout);
+	if (_sock == NO_SOCKET_AVAIL)
+	{
+		_sock = 255;
+		return 0;
+	}
+	return 1;
+}
+
+int WiFiEspClient::connectPoll()
+{
+	if (_sock >= MAX_SOCK_NUM)
+		return -1;
+
+	int r = WiFiEspClass::sockConnectPoll(_sock);
+	if (r < 0)
+		stop();
+	return r;
+}
+
 
 size_t WiFiEspClient::write(uint8_t b)
 {
@@ -143,85 +186,110 @@ size_t WiFiEspClient::write(const uint8_t *buf, size_t size)
 		return 0;
 	}
 
-	uint32_t r = esp32_spi_socket_write(_sock, (uint8_t *)buf, size);
-	if (!r)
+	bool error = false;
+	size_t sent = WiFiEspClass::sockWrite(_sock, buf, size, _timeout, error);
+	if (error)
+		setWriteError();
+	return sent;
+}
+
+size_t WiFiEspClient::write(WiFiEspWriteProducer producer, void *arg)
+{
+	if (_sock >= MAX_SOCK_NUM or producer == NULL)
 	{
 		setWriteError();
-		LOGERROR1(F("Failed to write to socket"), _sock);
-		delay(4000);
-		stop();
 		return 0;
 	}
 
-	return size;
+	bool error = false;
+	size_t total = WiFiEspClass::sockWrite(_sock, producer, arg, _timeout, error);
+	if (error)
+		setWriteError();
+	return total;
+}
+
+int WiFiEspClient::writeSome(const uint8_t *buf, size_t size)
+{
+	if (_sock >= MAX_SOCK_NUM)
+		return -1;
+
+	int n = WiFiEspClass::sockWriteSome(_sock, buf, size);
+	if (n < 0)
+		setWriteError();
+	return n;
 }
 
 
 
 int WiFiEspClient::available()
 {
-	if (_sock != 255)
-	{
-		int bytes = esp32_spi_socket_available(_sock);
-		if (bytes>0)
-		{
-			return bytes;
-		}
-	}
+	if (_sock >= MAX_SOCK_NUM)
+		return 0;
 
-	return 0;
+	return WiFiEspClass::sockAvailable(_sock);
 }
 
 int WiFiEspClient::read()
 {
-	uint8_t b;
-	if (!available())
+	if (_sock >= MAX_SOCK_NUM)
 		return -1;
 
-	bool connClose = false;
-	b = esp32_spi_get_data(_sock);
+	return WiFiEspClass::sockRead(_sock);
+}
 
-	if (connClose)
-	{
-		WiFiEspClass::releaseSocket(_sock);
-		_sock = 255;
-	}
+// returns up to size bytes, 0 if nothing has arrived yet, -1 once the
+// connection is closed and drained
+int WiFiEspClient::read(uint8_t* buf, size_t size)
+{
+	if (_sock >= MAX_SOCK_NUM)
+		return -1;
 
-	return b;
+	return WiFiEspClass::sockRead(_sock, buf, size);
 }
 
-int WiFiEspClient::read(uint8_t* buf, size_t size)
+int WiFiEspClient::readFully(uint8_t* buf, size_t size, unsigned long deadline)
 {
-	if (!available())
+	if (_sock >= MAX_SOCK_NUM)
 		return -1;
 
-	return esp32_spi_socket_read(_sock, buf, size);
+	return WiFiEspClass::sockReadFully(_sock, buf, size, deadline);
 }
 
 int WiFiEspClient::peek()
 {
-	uint8_t b;
-	if (!available())
+	if (_sock >= MAX_SOCK_NUM)
 		return -1;
 
-	bool connClose = false;
+	return WiFiEspClass::sockPeek(_sock);
+}
 
-	b = esp32_spi_get_data(_sock);
 
-	if (connClose)
-	{
-		WiFiEspClass::releaseSocket(_sock);
-		_sock = 255;
-	}
+void WiFiEspClient::flush()
+{
+	if (_sock >= MAX_SOCK_NUM)
+		return;
 
-	return b;
+	if (!WiFiEspClass::sockFlush(_sock, _timeout))
+		setWriteError();
 }
 
 
-void WiFiEspClient::flush()
+void WiFiEspClient::setOpportunisticRead(bool enable)
+{
+	if (_sock >= MAX_SOCK_NUM)
+		return;
+
+	WiFiEspClass::sockSetOpportunistic(_sock, enable);
+}
+
+
+void WiFiEspClient::setNoDelay(bool nodelay)
 {
-	while (available())
-		read();
+	if (_sock >= MAX_SOCK_NUM)
+		return;
+
+	if (!WiFiEspClass::sockSetNoDelay(_sock, nodelay, _timeout))
+		setWriteError();
 }
 
 
@@ -231,17 +299,16 @@ void WiFiEspClient::stop()
 	if (_sock == 255)
 		return;
 
-	LOGINFO1(F("Disconnecting "), _sock);
-
-	esp32_spi_socket_close(_sock);
-
-	WiFiEspClass::releaseSocket(_sock);
+	if (!WiFiEspClass::sockStop(_sock, _timeout))
+		setWriteError();
 	_sock = 255;
 }
 
 
 uint8_t WiFiEspClient::connected()
 {
+	if (_sock < MAX_SOCK_NUM)
+		WiFiEspClass::txFlushDue(_sock);
 	return (status() == SOCKET_ESTABLISHED);
 }
 
@@ -257,31 +324,16 @@ WiFiEspClient::operator bool()
 ////////////////////////////////////////////////////////////////////////////////
 
 
+// answered from the socket state cache, see WiFiEspClass::setSocketStateWindow()
 uint8_t WiFiEspClient::status()
 {
 	if (_sock == 255)
-	{
-//	LOGINFO1(F("SOCKET_CLOSED 1! "), _sock);
 		return SOCKET_CLOSED;
-	}
-
-	if (esp32_spi_socket_available(_sock) > 0)
-	{
-//	LOGINFO1(F("SOCKET_ESTABLISHED 1! "), _sock);
-		return SOCKET_ESTABLISHED;
-	}
-
-	if (esp32_spi_socket_status(_sock) == SOCKET_ESTABLISHED)
-	{
-//	LOGINFO1(F("SOCKET_ESTABLISHED 2! "), _sock);
-		return SOCKET_ESTABLISHED;
-	}
-
-//	LOGINFO1(F("SOCKET_CLOSED 2! "), _sock);
-	WiFiEspClass::releaseSocket(_sock);
-	_sock = 255;
 
-	return SOCKET_CLOSED;
+	uint8_t s = WiFiEspClass::sockStatus(_sock);
+	if (s == SOCKET_CLOSED)
+		_sock = 255;
+	return s;
 }
 
 IPAddress WiFiEspClient::remoteIP()
@@ -301,23 +353,10 @@ IPAddress WiFiEspClient::remoteIP()
 
 size_t WiFiEspClient::printFSH(const __FlashStringHelper *ifsh, bool appendCrLf)
 {
-	size_t size = strlen_P((char*)ifsh);
-	
-	if (_sock >= MAX_SOCK_NUM or size==0)
-	{
-		setWriteError();
-		return 0;
-	}
+	size_t size = write((const uint8_t *)ifsh, strlen_P((char*)ifsh));
 
-	uint32_t r = esp32_spi_socket_write(_sock, (uint8_t *)ifsh, size);
-	if (!r)
-	{
-		setWriteError();
-		LOGERROR1(F("Failed to write to socket"), _sock);
-		delay(4000);
-		stop();
-		return 0;
-	}
+	if (appendCrLf)
+		size += write((const uint8_t *)"\r\n", 2);
 
 	return size;
 }
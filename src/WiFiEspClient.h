@@ -27,6 +27,14 @@ along with The Arduino WiFiEsp library.  If not, see
 
 
 
+// fills at most size bytes of buf, returns how many it wrote, 0 at the end of the data
+typedef size_t (*WiFiEspWriteProducer)(uint8_t *buf, size_t size, void *arg);
+
+// Default connectAsync() timeout (ms)
+#ifndef WIFIESP_CONNECT_TIMEOUT_MS
+#define WIFIESP_CONNECT_TIMEOUT_MS 10000
+#endif
+
 class WiFiEspClient : public Client
 {
 public:
@@ -63,6 +71,20 @@ public:
   * Returns true if the connection succeeds, false if not.
   */
   int connectSSL(const char* host, uint16_t port);
+
+  /*
+  * Start connecting to the specified IP address or host and port, without waiting for the handshake.
+  * Host names are still resolved before returning.
+  * Returns 1 if the connection was started, 0 if not.
+  */
+  int connectAsync(IPAddress ip, uint16_t port, unsigned long timeout = WIFIESP_CONNECT_TIMEOUT_MS);
+  int connectAsync(const char *host, uint16_t port, unsigned long timeout = WIFIESP_CONNECT_TIMEOUT_MS);
+
+  /*
+  * Advance a connection started with connectAsync(). Call it until it stops returning 0.
+  * Returns 1 once connected, 0 while still connecting, -1 on failure or timeout.
+  */
+  int connectPoll();
   
   /*
   * Write a character to the server the client is connected to.
@@ -72,10 +94,26 @@ public:
 
   /*
   * Write data to the server the client is connected to.
-  * Returns the number of characters written.
+  * Returns the number of characters written, which is less than size if the
+  * module accepted nothing for setTimeout() milliseconds or the connection failed.
   */
   virtual size_t write(const uint8_t *buf, size_t size);
 
+  /*
+  * Write as much of the data as the module accepts right now, without waiting.
+  * Returns the number of characters taken, 0 if the socket would block, -1 on error.
+  */
+  int writeSome(const uint8_t *buf, size_t size);
+
+  /*
+  * Stream data from a producer until it returns 0. The producer fills at most size bytes of buf.
+  * Any size may also be passed to write(buf, size), both are sent in chunks of up to
+  * WIFIESP_WRITE_CHUNK_SIZE bytes. buf is shared by all clients, so the producer must not
+  * itself stream to another client.
+  * Returns the number of characters written.
+  */
+  size_t write(WiFiEspWriteProducer producer, void *arg = NULL);
+
 
   virtual int available();
 
@@ -86,18 +124,43 @@ public:
   virtual int read();
 
 
+  /*
+  * Read up to size bytes, whatever has arrived.
+  * Returns the number of bytes read, 0 if none are available yet, -1 if the connection is closed.
+  */
   virtual int read(uint8_t *buf, size_t size);
 
+  /*
+  * Read exactly size bytes, unless the connection closes or millis() reaches deadline first.
+  * Returns the number of bytes read, -1 if the connection closed before any arrived.
+  */
+  int readFully(uint8_t *buf, size_t size, unsigned long deadline);
+
   /*
   * Returns the next byte (character) of incoming serial data without removing it from the internal serial buffer.
   */
   virtual int peek();
 
   /*
-  * Discard any bytes that have been written to the client but not yet read.
+  * Send any bytes that have been written to the client but are still held in the transmit buffer.
   */
   virtual void flush();
 
+  /*
+  * With nodelay false, small writes are coalesced in a transmit buffer and sent when it fills up,
+  * on flush(), before reading, when WiFi.poll() waits for input on the socket, or by the first
+  * write(), connected(), WiFi.poll() or WiFi.maintain() call after they are WIFIESP_TX_LINGER_MS
+  * old. There is no timer: data is not sent while none of these are called. Default is true.
+  */
+  void setNoDelay(bool nodelay);
+
+  /*
+  * In opportunistic mode every poll is a single GET_DATABUF_TCP_CMD: available() fetches up to
+  * WIFIESP_RX_BUFFER_SIZE bytes instead of asking how many are waiting, so it reports at most
+  * that many, and read(buf, size) returns 0 rather than -1 after close (use connected()).
+  */
+  void setOpportunisticRead(bool enable);
+
   /*
   * Disconnect from the server.
   */
@@ -127,6 +190,11 @@ public:
   * Returns the remote IP address.
   */
   IPAddress remoteIP();
+
+  /*
+  * Returns the socket number used for WiFi.poll(), 255 if not connected.
+  */
+  uint8_t getSocket() { return _sock; }
   
 
   friend class WiFiEspServer;
@@ -136,6 +204,7 @@ private:
   uint8_t _sock;     // connection id
 
   int connect(const char* host, uint16_t port, uint8_t protMode);
+  int connectStart(uint8_t *dest, uint8_t destType, uint16_t port, uint8_t protMode, unsigned long timeout);
   
   size_t printFSH(const __FlashStringHelper *ifsh, bool appendCrLf);
 
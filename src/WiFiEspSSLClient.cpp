@@ -40,14 +40,14 @@ WiFiEspSSLClient::WiFiEspSSLClient(uint8_t sock) : _sock(sock)
 // this is very slow on ESP
 size_t WiFiEspSSLClient::print(const __FlashStringHelper *ifsh)
 {
-	printFSH(ifsh, false);
+	return printFSH(ifsh, false);
 }
 
 // if we do override this, the standard println will call the print
 // method twice
 size_t WiFiEspSSLClient::println(const __FlashStringHelper *ifsh)
 {
-	printFSH(ifsh, true);
+	return printFSH(ifsh, true);
 }
 
 
@@ -100,6 +100,47 @@ int WiFiEspSSLClient::connect(const char* host, uint16_t port, uint8_t protMode)
 }
 
 
+int WiFiEspSSLClient::connectAsync(IPAddress ip, uint16_t port, unsigned long timeout)
+{
+	char s[16];
+	sprintf_P(s, PSTR("%d.%d.%d.%d"), ip[0], ip[1], ip[2], ip[3]);
+
+	return connectAsync(s, port, timeout);
+}
+
+int WiFiEspSSLClient::connectAsync(const char* host, uint16_t port, unsigned long timeout)
+{
+	LOGINFO1(F("Connecting to"), host);
+
+	return connectStart((uint8_t *)host, 1, port, TLS_MODE, timeout);
+}
+
+/* Private method */
+int WiFiEspSSLClient::connectStart(uint8_t *dest, uint8_t destType, uint16_t port, uint8_t protMode, unsigned long timeout)
+{
+	if (_sock != 255)
+		stop();
+
+	_sock = WiFiEspClass::sockConnectStart(dest, destType, port, protMode, timeout);
+	if (_sock == NO_SOCKET_AVAIL)
+	{
+		_sock = 255;
+		return 0;
+	}
+	return 1;
+}
+
+int WiFiEspSSLClient::connectPoll()
+{
+	if (_sock >= MAX_SOCK_NUM)
+		return -1;
+
+	int r = WiFiEspClass::sockConnectPoll(_sock);
+	if (r < 0)
+		stop();
+	return r;
+}
+
 
 size_t WiFiEspSSLClient::write(uint8_t b)
 {
@@ -114,96 +155,129 @@ size_t WiFiEspSSLClient::write(const uint8_t *buf, size_t size)
 		return 0;
 	}
 
-	uint32_t r = esp32_spi_socket_write(_sock, (uint8_t *)buf, size);
-	if (!r)
+	bool error = false;
+	size_t sent = WiFiEspClass::sockWrite(_sock, buf, size, _timeout, error);
+	if (error)
+		setWriteError();
+	return sent;
+}
+
+size_t WiFiEspSSLClient::write(WiFiEspWriteProducer producer, void *arg)
+{
+	if (_sock >= MAX_SOCK_NUM or producer == NULL)
 	{
 		setWriteError();
-		LOGERROR1(F("Failed to write to socket"), _sock);
-		delay(4000);
-		stop();
 		return 0;
 	}
 
-	return size;
+	bool error = false;
+	size_t total = WiFiEspClass::sockWrite(_sock, producer, arg, _timeout, error);
+	if (error)
+		setWriteError();
+	return total;
+}
+
+int WiFiEspSSLClient::writeSome(const uint8_t *buf, size_t size)
+{
+	if (_sock >= MAX_SOCK_NUM)
+		return -1;
+
+	int n = WiFiEspClass::sockWriteSome(_sock, buf, size);
+	if (n < 0)
+		setWriteError();
+	return n;
 }
 
 
 
 int WiFiEspSSLClient::available()
 {
-	if (_sock != 255)
-	{
-		int bytes = esp32_spi_socket_available(_sock);
-		if (bytes>0)
-		{
-			return bytes;
-		}
-	}
+	if (_sock >= MAX_SOCK_NUM)
+		return 0;
 
-	return 0;
+	return WiFiEspClass::sockAvailable(_sock);
 }
 
 int WiFiEspSSLClient::read()
 {
-	uint8_t b;
-	if (!available())
+	if (_sock >= MAX_SOCK_NUM)
 		return -1;
 
-	bool connClose = false;
-	b = esp32_spi_get_data(_sock);
+	return WiFiEspClass::sockRead(_sock);
+}
 
-	if (connClose)
-	{
-		WiFiEspClass::releaseSocket(_sock);
-		_sock = 255;
-	}
+// returns up to size bytes, 0 if nothing has arrived yet, -1 once the
+// connection is closed and drained
+int WiFiEspSSLClient::read(uint8_t* buf, size_t size)
+{
+	if (_sock >= MAX_SOCK_NUM)
+		return -1;
 
-	return b;
+	return WiFiEspClass::sockRead(_sock, buf, size);
 }
 
-int WiFiEspSSLClient::read(uint8_t* buf, size_t size)
+int WiFiEspSSLClient::readFully(uint8_t* buf, size_t size, unsigned long deadline)
 {
-	if (!available())
+	if (_sock >= MAX_SOCK_NUM)
 		return -1;
-	return esp32_spi_socket_read(_sock, buf, size);
+
+	return WiFiEspClass::sockReadFully(_sock, buf, size, deadline);
 }
 
 int WiFiEspSSLClient::peek()
 {
-	uint8_t b;
-	if (!available())
+	if (_sock >= MAX_SOCK_NUM)
 		return -1;
 
-	b = esp32_spi_get_data(_sock);
-
-	return b;
+	return WiFiEspClass::sockPeek(_sock);
 }
 
 
 void WiFiEspSSLClient::flush()
 {
-	while (available())
-		read();
+	if (_sock >= MAX_SOCK_NUM)
+		return;
+
+	if (!WiFiEspClass::sockFlush(_sock, _timeout))
+		setWriteError();
 }
 
 
+void WiFiEspSSLClient::setOpportunisticRead(bool enable)
+{
+	if (_sock >= MAX_SOCK_NUM)
+		return;
+
+	WiFiEspClass::sockSetOpportunistic(_sock, enable);
+}
+
 
-void WiFiEspSSLClient::stop()
+void WiFiEspSSLClient::setNoDelay(bool nodelay)
 {
-	if (_sock == 255)
+	if (_sock >= MAX_SOCK_NUM)
 		return;
 
-	LOGINFO1(F("Disconnecting "), _sock);
+	if (!WiFiEspClass::sockSetNoDelay(_sock, nodelay, _timeout))
+		setWriteError();
+}
+
 
-	esp32_spi_socket_close(_sock);
 
-	WiFiEspClass::releaseSocket(_sock);
+void WiFiEspSSLClient::stop()
+{
+	if (_sock == 255)
+		return;
+
+	if (!WiFiEspClass::sockStop(_sock, _timeout))
+		setWriteError();
 	_sock = 255;
 }
 
 
 uint8_t WiFiEspSSLClient::connected()
 {
+	if (_sock < MAX_SOCK_NUM)
+		WiFiEspClass::txFlushDue(_sock);
 	return (status() == SOCKET_ESTABLISHED);
 }
 
@@ -231,31 +305,16 @@ void WiFiEspSSLClient::setPrivateKey(const char *private_key)
 ////////////////////////////////////////////////////////////////////////////////
 
 
+// answered from the socket state cache, see WiFiEspClass::setSocketStateWindow()
 uint8_t WiFiEspSSLClient::status()
 {
 	if (_sock == 255)
-	{
-//	LOGINFO1(F("SOCKET_CLOSED 1! "), _sock);
 		return SOCKET_CLOSED;
-	}
-
-	if (esp32_spi_socket_available(_sock) == 0)
-	{
-//	LOGINFO1(F("SOCKET_ESTABLISHED 1! "), _sock);
-		return SOCKET_ESTABLISHED;
-	}
-
-	if (esp32_spi_socket_status(_sock) == SOCKET_ESTABLISHED)
-	{
-//	LOGINFO1(F("SOCKET_ESTABLISHED 2! "), _sock);
-		return SOCKET_ESTABLISHED;
-	}
-
-//	LOGINFO1(F("SOCKET_CLOSED 2! "), _sock);
-	WiFiEspClass::releaseSocket(_sock);
-	_sock = 255;
 
-	return SOCKET_CLOSED;
+	uint8_t s = WiFiEspClass::sockStatus(_sock);
+	if (s == SOCKET_CLOSED)
+		_sock = 255;
+	return s;
 }
 
 IPAddress WiFiEspSSLClient::remoteIP()
@@ -284,23 +343,10 @@ uint16_t WiFiEspSSLClient::remotePort()
 
 size_t WiFiEspSSLClient::printFSH(const __FlashStringHelper *ifsh, bool appendCrLf)
 {
-	size_t size = strlen_P((char*)ifsh);
-	
-	if (_sock >= MAX_SOCK_NUM or size==0)
-	{
-		setWriteError();
-		return 0;
-	}
+	size_t size = write((const uint8_t *)ifsh, strlen_P((char*)ifsh));
 
-	uint32_t r = esp32_spi_socket_write(_sock, (uint8_t *)ifsh, size);
-	if (!r)
-	{
-		setWriteError();
-		LOGERROR1(F("Failed to write to socket"), _sock);
-		delay(4000);
-		stop();
-		return 0;
-	}
+	if (appendCrLf)
+		size += write((const uint8_t *)"\r\n", 2);
 
 	return size;
 }
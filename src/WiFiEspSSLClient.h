@@ -24,6 +24,7 @@ along with The Arduino WiFiEsp library.  If not, see
 #include "Print.h"
 #include "Client.h"
 #include "IPAddress.h"
+#include "WiFiEspClient.h"
 
 
 
@@ -42,13 +43,29 @@ public:
   virtual int connect(IPAddress ip, uint16_t port);
   virtual int connect(const char *host, uint16_t port);
   virtual int connect(const char* host, uint16_t port, const char* client_cert, const char* client_key);
+
+  /*
+  * Non-blocking connect, see WiFiEspClient::connectAsync() and WiFiEspClient::connectPoll().
+  */
+  int connectAsync(IPAddress ip, uint16_t port, unsigned long timeout = WIFIESP_CONNECT_TIMEOUT_MS);
+  int connectAsync(const char *host, uint16_t port, unsigned long timeout = WIFIESP_CONNECT_TIMEOUT_MS);
+  int connectPoll();
   virtual size_t write(uint8_t);
   virtual size_t write(const uint8_t *buf, size_t size);
+  int writeSome(const uint8_t *buf, size_t size);
+  size_t write(WiFiEspWriteProducer producer, void *arg = NULL);
   virtual int available();
   virtual int read();
   virtual int read(uint8_t *buf, size_t size);
+  int readFully(uint8_t *buf, size_t size, unsigned long deadline);
   virtual int peek();
   virtual void flush();
+
+  /*
+  * With nodelay false, small writes are coalesced before being sent, see WiFiEspClient::setNoDelay().
+  */
+  void setNoDelay(bool nodelay);
+  void setOpportunisticRead(bool enable);
   virtual void stop();
   virtual uint8_t connected();
   virtual uint8_t status();
@@ -64,6 +81,7 @@ public:
 
   virtual IPAddress remoteIP();
   virtual uint16_t remotePort();
+  uint8_t getSocket() { return _sock; }
   
 
   friend class WiFiEspServer;
@@ -71,6 +89,7 @@ public:
 private:
   uint8_t _sock;     // connection id
   int connect(const char* host, uint16_t port, uint8_t protMode);
+  int connectStart(uint8_t *dest, uint8_t destType, uint16_t port, uint8_t protMode, unsigned long timeout);
   size_t printFSH(const __FlashStringHelper *ifsh, bool appendCrLf);
 
 };
@@ -42,7 +42,7 @@ void WiFiEspServer::begin()
 #else
 	_sock = 1; // If this is already in use, the startServer attempt will fail
 #endif
-	WiFiEspClass::allocateSocket(_sock);
+	WiFiEspClass::allocateServerSocket(_sock);
 
 //	_started = EspDrv::startServer(_port, _sock);
 	_started = esp32_spi_start_server(_sock, 0, 0, _port, TCP_MODE);
@@ -67,6 +67,14 @@ WiFiEspClient WiFiEspServer::available(byte* status)
 //		LOGINFO1(F("New client"), EspDrv::_connId);
 //		WiFiEspClass::allocateSocket(EspDrv::_connId);
 //		WiFiEspClient client(EspDrv::_connId);
+	// a client WiFi.poll() already accepted
+	int16_t accepted = WiFiEspClass::takeAccepted(_sock);
+	if (accepted != NA_STATE)
+	{
+		LOGINFO1(F("New client"), accepted);
+		return WiFiEspClient(accepted);
+	}
+
 	int bytes = esp32_spi_socket_available(_sock);
 	if (bytes != 255 && bytes != -1)
 	{
@@ -50,6 +50,11 @@ public:
 
 	uint8_t status();
 
+	/*
+	* Returns the listening socket number, poll it with WIFIESP_POLLACCEPT.
+	*/
+	uint8_t getSocket() { return _sock; }
+
 	using Print::write;
 
 
@@ -74,7 +74,7 @@ void WiFiEspUDP::stop()
       
       // Stop the listener and return the socket to the pool
 	  esp32_spi_socket_close(_sock);
-      WiFiEspClass::_state[_sock] = NA_STATE;
+      WiFiEspClass::releaseSocket(_sock);
       WiFiEspClass::_server_port[_sock] = 0;
 
 	  _sock = NO_SOCKET_AVAIL;
@@ -148,23 +148,29 @@ int WiFiEspUDP::parsePacket()
 	return available();
 }
 
+// reads go straight to GET_DATABUF_TCP_CMD, an empty reply means no data,
+// so polling costs one transaction instead of AVAIL_DATA_TCP_CMD + read
 int WiFiEspUDP::read()
 {
 	uint8_t b;
-	if (!available())
+	if (_sock == NO_SOCKET_AVAIL)
 		return -1;
 
-    // Read the data and handle the timeout condition
-	b = esp32_spi_get_data(_sock);
+	if (esp32_spi_socket_read(_sock, &b, 1) <= 0)
+		return -1;
 
 	return b;
 }
 
 int WiFiEspUDP::read(uint8_t* buf, size_t size)
 {
-	if (!available())
+	if (_sock == NO_SOCKET_AVAIL || size == 0)
+		return -1;
+
+	int n = esp32_spi_socket_read(_sock, buf, size > 0xffff ? 0xffff : size);
+	if (n <= 0)
 		return -1;
-	return esp32_spi_socket_read(_sock, buf, size);
+	return n;
 }
 
 int WiFiEspUDP::peek()
@@ -90,6 +90,9 @@ public:
   // Return the port of the host who sent the current incoming packet
   virtual uint16_t remotePort();
 
+  // Return the socket number used for WiFi.poll()
+  uint8_t getSocket() { return _sock; }
+
   virtual uint8_t beginMulticast(IPAddress ip, uint16_t port);
 
   friend class WiFiEspServer;
@@ -20,13 +20,74 @@ uint32_t time;
 float temperature;
 
 static void esp32_spi_reset(void);
+static void esp32_spi_drop_pending(void);
 static void delete_esp32_spi_params(void *arg);
 static void delete_esp32_spi_aps_list(void *arg);
-static esp32_spi_params_t *esp32_spi_params_alloc_1param(uint32_t len, uint8_t *buf);
-static esp32_spi_params_t *esp32_spi_params_alloc_2param(uint32_t len_0, uint8_t *buf_0, uint32_t len_1, uint8_t *buf_1);
-static int8_t esp32_spi_send_command(uint8_t cmd, esp32_spi_params_t *params, uint8_t param_len_16);
+static int8_t esp32_spi_send_command(uint8_t cmd, const esp32_spi_param_t *params, uint32_t params_num, uint8_t param_len_16);
+static int32_t esp32_spi_send_command_get_response_into(uint8_t cmd, const esp32_spi_param_t *params, uint32_t params_num, esp32_spi_param_t *resp, uint32_t resp_num, uint8_t sent_param_len_16, uint8_t recv_param_len_16);
+static void esp32_spi_resolve_complete(void);
+static void esp32_spi_scan_complete(void);
+static int32_t esp32_spi_read_scan_list(esp32_spi_ap_t *aps, uint32_t max);
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+
+// hard SPI clock ladder for link training and runtime back-off
+static const uint32_t clk_steps[] = {
+    1000000 * 4, 1000000 * 6, ESP32_SPI_CLK_DEFAULT, 1000000 * 12,
+    1000000 * 16, 1000000 * 20, 1000000 * 26, 1000000 * 32};
+#define CLK_STEP_DEFAULT 2
+static uint8_t clk_step = CLK_STEP_DEFAULT;
+static uint8_t clk_training = 0;
+static uint8_t link_errors = 0;
+// fastest step known to work, and clean replies since the last error
+static uint8_t clk_ceiling = CLK_STEP_DEFAULT;
+static uint16_t link_clean = 0;
+
+#if ESP32_SPI_RDY_IRQ && ESP32_SPI_RDY_WFI
+// bumped by the ready pin edge interrupt, only needed to wake a wfi sleep
+static volatile uint32_t rdy_edges = 0;
+
+static int esp32_spi_rdy_irq(void *ctx)
+{
+    rdy_edges++;
+    return 0;
+}
 
-void esp32_spi_init(uint8_t t_cs_num, uint8_t t_rst_num, uint8_t t_rdy_num, uint8_t t_hard_spi)
+//Sleep until an interrupt, unless the ready pin toggled since edges was read.
+//Machine interrupts are masked across the check and the wfi so an edge in
+//between cannot be lost: wfi still wakes on the pending interrupt, which is
+//then taken once the previous MIE state is restored
+static void esp32_spi_rdy_sleep(uint32_t edges)
+{
+    unsigned long mstatus;
+
+    asm volatile("csrrci %0, mstatus, 8" : "=r"(mstatus) : : "memory");
+    if (rdy_edges == edges)
+        asm volatile("wfi");
+    asm volatile("csrs mstatus, %0" : : "r"(mstatus & 8) : "memory");
+}
+#endif
+
+// reset / boot detection, see esp32_spi_boot_start
+#define BOOT_IDLE       0
+#define BOOT_RESET      1   // reset held low, or SOFT_RESET_CMD sent and not acted on yet
+#define BOOT_WAIT       2   // firmware starting, probed until it answers
+#define BOOT_FAILED     3
+static uint8_t boot_state = BOOT_IDLE;
+static uint64_t boot_start_us = 0, boot_probe_us = 0;
+
+// while the firmware boots, a wait is cut to one probe's worth so an
+// unanswered probe never stalls for the full timeout
+static uint64_t esp32_spi_rdy_budget(uint64_t timeout_us)
+{
+    if (boot_state != BOOT_IDLE && timeout_us > ESP32_SPI_BOOT_PROBE_TIMEOUT_MS * 1000)
+        return ESP32_SPI_BOOT_PROBE_TIMEOUT_MS * 1000;
+    return timeout_us;
+}
+
+// Set up the pins and start resetting the ESP32 without waiting for it;
+// follow with esp32_spi_boot_poll. The SPI pins must already be configured
+void esp32_spi_init_start(uint8_t t_cs_num, uint8_t t_rst_num, uint8_t t_rdy_num, uint8_t t_hard_spi)
 {
     cs_num = t_cs_num, rst_num = t_rst_num, rdy_num = t_rdy_num, is_hard_spi = t_hard_spi;
     //cs
@@ -35,6 +96,10 @@ void esp32_spi_init(uint8_t t_cs_num, uint8_t t_rst_num, uint8_t t_rdy_num, uint
 
     //ready
     gpiohs_set_drive_mode(rdy_num, GPIO_DM_INPUT); //ready
+#if ESP32_SPI_RDY_IRQ && ESP32_SPI_RDY_WFI
+    gpiohs_set_pin_edge(rdy_num, GPIO_PE_BOTH);
+    gpiohs_irq_register(rdy_num, 1, esp32_spi_rdy_irq, NULL);
+#endif
 
     if ((int8_t)rst_num > 0)
     {
@@ -46,41 +111,158 @@ void esp32_spi_init(uint8_t t_cs_num, uint8_t t_rst_num, uint8_t t_rdy_num, uint
     gpiohs_set_drive_mode(ESP32_SPI_IO0_HS_NUM, GPIO_DM_INPUT); //gpio0
 #endif
 
-    esp32_spi_reset();
+    esp32_spi_boot_start();
 }
 
-//Hard reset the ESP32 using the reset pin
+void esp32_spi_init(uint8_t t_cs_num, uint8_t t_rst_num, uint8_t t_rdy_num, uint8_t t_hard_spi)
+{
+    esp32_spi_init_start(t_cs_num, t_rst_num, t_rdy_num, t_hard_spi);
+    while (esp32_spi_boot_poll() == 0)
+        ;
+}
+
+//Reset the ESP32 and wait until its firmware answers
 static void esp32_spi_reset(void)
+{
+    esp32_spi_boot_start();
+    while (esp32_spi_boot_poll() == 0)
+        ;
+}
+
+// Reset the ESP32, with the reset pin if there is one, and return at once.
+// Replies still owed by split-phase operations are lost with the firmware state
+void esp32_spi_boot_start(void)
 {
 #if ESP32_SPI_DEBUG
     printk("Reset ESP32\r\n");
 #endif
 
+    esp32_spi_drop_pending();
+
 #if ESP32_HAVE_IO0
     gpiohs_set_drive_mode(ESP32_SPI_IO0_HS_NUM, GPIO_DM_OUTPUT); //gpio0
     gpiohs_set_pin(ESP32_SPI_IO0_HS_NUM, 1);
 #endif
 
-    //here we sleep 1s
     gpiohs_set_pin(cs_num, 1);
 
     if ((int8_t)rst_num > 0)
-    {
         gpiohs_set_pin(rst_num, 0);
-        msleep(500);
-        gpiohs_set_pin(rst_num, 1);
-        msleep(800);
-    }
     else
+        esp32_spi_send_command(SOFT_RESET_CMD, NULL, 0, 0); //soft reset
+
+    boot_state = BOOT_RESET;
+    boot_start_us = sysctl_get_time_us();
+    boot_probe_us = 0;
+}
+
+// Advance a reset started by esp32_spi_boot_start without blocking: release
+// the reset line after ESP32_SPI_RESET_PULSE_MS, then, whenever the ready pin
+// is low, probe with GET_CONN_STATUS_CMD until the firmware answers
+//1 firmware up
+//0 still booting
+//-1 no answer within ESP32_SPI_BOOT_TIMEOUT_MS
+int8_t esp32_spi_boot_poll(void)
+{
+    uint64_t now = sysctl_get_time_us();
+
+    if (boot_state == BOOT_IDLE)
+        return 1;
+    if (boot_state == BOOT_FAILED)
+        return -1;
+
+    if (boot_state == BOOT_RESET)
     {
-        //soft reset
-        esp32_spi_send_command(SOFT_RESET_CMD, NULL, 0);
-        msleep(1500);
+        uint64_t hold_ms = (int8_t)rst_num > 0 ? ESP32_SPI_RESET_PULSE_MS : ESP32_SPI_SOFT_RESET_SETTLE_MS;
+        if (now - boot_start_us < hold_ms * 1000)
+            return 0;
+
+        if ((int8_t)rst_num > 0)
+            gpiohs_set_pin(rst_num, 1);
+        boot_state = BOOT_WAIT;
+        boot_start_us = now;
+        return 0;
     }
 
+    if (now - boot_start_us >= (uint64_t)ESP32_SPI_BOOT_TIMEOUT_MS * 1000)
+    {
+#if ESP32_SPI_DEBUG
+        printk("%s: esp32 not responding after reset\r\n", __func__);
+#endif
+        boot_state = BOOT_FAILED;
+#if ESP32_HAVE_IO0
+        gpiohs_set_drive_mode(ESP32_SPI_IO0_HS_NUM, GPIO_DM_INPUT); //gpio0
+#endif
+        return -1;
+    }
+
+    // the ready pin is high while the firmware cannot take a command
+    if (gpiohs_get_pin(rdy_num) != 0 || now - boot_probe_us < ESP32_SPI_BOOT_PROBE_MS * 1000)
+        return 0;
+    boot_probe_us = now;
+
+    if (esp32_spi_status() == -2)
+        return 0;
+
+#if ESP32_SPI_DEBUG
+    printk("%s: esp32 up after %d ms\r\n", __func__, (int)((sysctl_get_time_us() - boot_start_us) / 1000));
+#endif
+    boot_state = BOOT_IDLE;
+    // probes into a booting chip are not link errors
+    link_errors = 0;
 #if ESP32_HAVE_IO0
     gpiohs_set_drive_mode(ESP32_SPI_IO0_HS_NUM, GPIO_DM_INPUT); //gpio0
 #endif
+    return 1;
+}
+
+//Assert CS; with hard SPI the controller is configured once for the frame
+static void esp32_spi_select(void)
+{
+    if (is_hard_spi)
+        hard_spi_begin_transaction();
+    gpiohs_set_pin(cs_num, 0);
+}
+
+//Release CS and end the hard SPI session
+static void esp32_spi_deselect(void)
+{
+    gpiohs_set_pin(cs_num, 1);
+    if (is_hard_spi)
+        hard_spi_end_transaction();
+}
+
+//Wait until the ready pin reads level
+//the pin is sampled on every pass, so a missed or undelivered edge interrupt
+//never stretches the wait. With ESP32_SPI_RDY_WFI the core sleeps between
+//samples once ESP32_SPI_RDY_SPIN_US have passed and the edge interrupt wakes
+//it; without it this is a busy poll, costing the same CPU as the SDK's
+//busy-waiting msleep but answering within a few us
+// 0 ok
+// -1 timeout
+static int8_t esp32_spi_wait_rdy(uint8_t level, uint64_t timeout_us)
+{
+    uint64_t tm = sysctl_get_time_us();
+    uint64_t elapsed = 0;
+#if ESP32_SPI_RDY_IRQ && ESP32_SPI_RDY_WFI
+    uint32_t edges = rdy_edges;
+#endif
+
+    while (1)
+    {
+        if (gpiohs_get_pin(rdy_num) == level)
+            return 0;
+
+        elapsed = sysctl_get_time_us() - tm;
+        if (elapsed >= timeout_us)
+            return -1;
+
+#if ESP32_SPI_RDY_IRQ && ESP32_SPI_RDY_WFI
+        if (elapsed >= ESP32_SPI_RDY_SPIN_US)
+            esp32_spi_rdy_sleep(edges);
+        edges = rdy_edges;
+#endif
+    }
 }
 
 //Wait until the ready pin goes low
@@ -92,17 +274,8 @@ int8_t esp32_spi_wait_for_ready(void)
     printk("Wait for ESP32 ready\r\n");
 #endif
 
-    uint64_t tm = sysctl_get_time_us();
-    while ((sysctl_get_time_us() - tm) < 10 * 1000 * 1000) //10s
-    {
-        if (gpiohs_get_pin(rdy_num) == 0)
-            return 0;
-
-#if (ESP32_SPI_DEBUG >= 3)
-        printk(".");
-#endif
-        msleep(1); //FIXME
-    }
+    if (esp32_spi_wait_rdy(0, esp32_spi_rdy_budget(10 * 1000 * 1000)) == 0) //10s
+        return 0;
 
 #if (ESP32_SPI_DEBUG >= 3)
     printk("esp32 not responding\r\n");
@@ -111,37 +284,41 @@ int8_t esp32_spi_wait_for_ready(void)
     return -1;
 }
 
-#define lc_buf_len 256
+// big enough for a full SPI_MAX_DMA_LEN payload plus frame overhead,
+// so socket writes never need a heap buffer
+#define lc_buf_len (SPI_MAX_DMA_LEN + 64)
 uint8_t lc_send_buf[lc_buf_len];
-uint8_t lc_buf_flag = 0;
 
 /// Send over a command with a list of parameters
+// params is an array of (length, pointer) descriptors owned by the caller,
+// usually on its stack; each param is copied once, straight into the frame
 // -1 error
 // other right
-static int8_t esp32_spi_send_command(uint8_t cmd, esp32_spi_params_t *params, uint8_t param_len_16)
+static int8_t esp32_spi_send_command(uint8_t cmd, const esp32_spi_param_t *params, uint32_t params_num, uint8_t param_len_16)
 {
     uint32_t packet_len = 0;
 
+    // a split-phase lookup or scan still owes its reply
+    esp32_spi_resolve_complete();
+    esp32_spi_scan_complete();
+
     packet_len = 4; // header + end byte
-    if (params != NULL)
+    for (uint32_t i = 0; i < params_num; i++)
     {
-        for (uint32_t i = 0; i < params->params_num; i++)
-        {
-            packet_len += params->params[i]->param_len;
-            packet_len += 1; // size byte
-            if (param_len_16)
-                packet_len += 1;
-        }
+        packet_len += params[i].param_len;
+        packet_len += 1; // size byte
+        if (param_len_16)
+            packet_len += 1;
     }
     while (packet_len % 4 != 0)
         packet_len += 1;
 
-    uint8_t *sendbuf = NULL;
+    uint8_t *sendbuf = lc_send_buf;
 
+    // only oversized frames (certificates etc.) fall back to the heap
     if (packet_len > lc_buf_len)
     {
         sendbuf = (uint8_t *)malloc(sizeof(uint8_t) * packet_len);
-        lc_buf_flag = 0;
         if (!sendbuf)
         {
 #if (ESP32_SPI_DEBUG)
@@ -150,69 +327,46 @@ static int8_t esp32_spi_send_command(uint8_t cmd, esp32_spi_params_t *params, ui
             return -1;
         }
     }
-    else
-    {
-        sendbuf = lc_send_buf;
-        lc_buf_flag = 1;
-    }
 
     sendbuf[0] = START_CMD;
     sendbuf[1] = cmd & ~REPLY_FLAG;
-    if (params != NULL)
-        sendbuf[2] = params->params_num;
-    else
-        sendbuf[2] = 0;
+    sendbuf[2] = params_num;
 
     uint32_t ptr = 3;
 
-    if (params != NULL)
+    //handle parameters here
+    for (uint32_t i = 0; i < params_num; i++)
     {
-        //handle parameters here
-        for (uint32_t i = 0; i < params->params_num; i++)
-        {
 #if (ESP32_SPI_DEBUG >= 2)
-            printk("\tSending param #%d is %d bytes long\r\n", i, params->params[i]->param_len);
+        printk("\tSending param #%d is %d bytes long\r\n", i, params[i].param_len);
 #endif
 
-            if (param_len_16)
-            {
-                sendbuf[ptr] = (uint8_t)((params->params[i]->param_len >> 8) & 0xFF);
-                ptr += 1;
-            }
-            sendbuf[ptr] = (uint8_t)(params->params[i]->param_len & 0xFF);
+        if (param_len_16)
+        {
+            sendbuf[ptr] = (uint8_t)((params[i].param_len >> 8) & 0xFF);
             ptr += 1;
-            memcpy(sendbuf + ptr, params->params[i]->param, params->params[i]->param_len);
-            ptr += params->params[i]->param_len;
         }
+        sendbuf[ptr] = (uint8_t)(params[i].param_len & 0xFF);
+        ptr += 1;
+        memcpy(sendbuf + ptr, params[i].param, params[i].param_len);
+        ptr += params[i].param_len;
     }
-    sendbuf[ptr] = END_CMD;
+    sendbuf[ptr++] = END_CMD;
+    // zero the alignment padding
+    while (ptr < packet_len)
+        sendbuf[ptr++] = 0;
 
     esp32_spi_wait_for_ready();
-    gpiohs_set_pin(cs_num, 0);
-
-    uint64_t tm = sysctl_get_time_us();
-    while ((sysctl_get_time_us() - tm) < 1000 * 1000 * TIMEOUT)
-    {
-        if (gpiohs_get_pin(rdy_num))
-            break;
-        msleep(1);
-    }
+    esp32_spi_select();
 
-    if ((sysctl_get_time_us() - tm) > 1000 * 1000 * TIMEOUT)
+    if (esp32_spi_wait_rdy(1, esp32_spi_rdy_budget(1000 * 1000 * TIMEOUT)) != 0)
     {
 #if (ESP32_SPI_DEBUG)
         printk("ESP32 timed out on SPI select\r\n");
 #endif
-        gpiohs_set_pin(cs_num, 1);
-        if (lc_buf_flag == 0)
-        {
+        esp32_spi_deselect();
+        if (sendbuf != lc_send_buf)
             free(sendbuf);
-            sendbuf = NULL;
-        }
-        else
-        {
-            memset(sendbuf, 0, packet_len);
-        }
         return -1;
     }
 
@@ -221,7 +375,7 @@ static int8_t esp32_spi_send_command(uint8_t cmd, esp32_spi_params_t *params, ui
     } else {
         soft_spi_rw_len(sendbuf, NULL, packet_len);
     }
-    gpiohs_set_pin(cs_num, 1);
+    esp32_spi_deselect();
 
 #if (ESP32_SPI_DEBUG >= 3)
     if (packet_len < 100)
@@ -232,24 +386,54 @@ static int8_t esp32_spi_send_command(uint8_t cmd, esp32_spi_params_t *params, ui
         printk("\r\n");
     }
 #endif
-    if (lc_buf_flag == 0)
-    {
+    if (sendbuf != lc_send_buf)
         free(sendbuf);
-        sendbuf = NULL;
-    }
-    else
-    {
-        memset(sendbuf, 0, packet_len);
-    }
     return 0;
 }
 
+// response frames are read in one burst into this window and parsed from
+// there; reads past the burst fall through to the bus
+#define lc_recv_buf_len 64
+// burst size when the reply layout is not known up front
+#define lc_recv_burst_default 16
+static uint8_t lc_recv_buf[lc_recv_buf_len];
+static uint32_t lc_recv_pos = 0, lc_recv_len = 0;
+
+/// Raw SPI reads, bypassing the burst window
+static void esp32_spi_bus_read(uint8_t *buffer, uint32_t len)
+{
+    if (is_hard_spi) {
+        hard_spi_rw_len(NULL, buffer, len);
+    } else {
+        soft_spi_rw_len(NULL, buffer, len);
+    }
+}
+
+/// Clock len bytes of the current frame into the burst window
+static void esp32_spi_read_burst(uint32_t len)
+{
+    if (len > lc_recv_buf_len)
+        len = lc_recv_buf_len;
+    esp32_spi_bus_read(lc_recv_buf, len);
+    lc_recv_pos = 0;
+    lc_recv_len = len;
+}
+
+/// Forget whatever is left of the burst window at the end of a frame
+static void esp32_spi_read_burst_end(void)
+{
+    lc_recv_pos = 0;
+    lc_recv_len = 0;
+}
+
 /// Read one byte from SPI
 uint8_t esp32_spi_read_byte(void)
 {
     uint8_t read = 0x0;
 
-    if (is_hard_spi) {
+    if (lc_recv_pos < lc_recv_len) {
+        read = lc_recv_buf[lc_recv_pos++];
+    } else if (is_hard_spi) {
         read = hard_spi_rw(0xff);
     } else {
         read = soft_spi_rw(0xff);
@@ -265,11 +449,17 @@ uint8_t esp32_spi_read_byte(void)
 ///Read many bytes from SPI
 void esp32_spi_read_bytes(uint8_t *buffer, uint32_t len)
 {
-    if (is_hard_spi) {
-        hard_spi_rw_len(NULL, buffer, len);
-    } else {
-        soft_spi_rw_len(NULL, buffer, len);
+    uint32_t buffered = lc_recv_len - lc_recv_pos;
+
+    if (buffered > len)
+        buffered = len;
+    if (buffered)
+    {
+        memcpy(buffer, lc_recv_buf + lc_recv_pos, buffered);
+        lc_recv_pos += buffered;
     }
+    if (len > buffered)
+        esp32_spi_bus_read(buffer + buffered, len - buffered);
 
 #if (ESP32_SPI_DEBUG >= 3)
     if (len < 100)
@@ -335,40 +525,81 @@ uint8_t esp32_spi_check_data(uint8_t want)
     return 0;
 }
 
-///Wait for ready, then parse the response
-//NULL error
-esp32_spi_params_t *esp32_spi_wait_response_cmd(uint8_t cmd, uint32_t *num_responses, uint8_t param_len_16)
+//Count a framing error; after ESP32_SPI_LINK_ERR_MAX in a row the hard SPI
+//clock steps down one notch
+static void esp32_spi_link_error(void)
 {
-    uint32_t num_of_resp = 0;
+    if (!is_hard_spi || clk_training || boot_state != BOOT_IDLE)
+        return;
 
-    esp32_spi_wait_for_ready();
+    link_clean = 0;
 
-    gpiohs_set_pin(cs_num, 0);
+    if (++link_errors < ESP32_SPI_LINK_ERR_MAX)
+        return;
+    link_errors = 0;
 
-    uint64_t tm = sysctl_get_time_us();
-    while ((sysctl_get_time_us() - tm) < 1000 * 1000 * TIMEOUT)
+    if (clk_step > 0)
     {
-        if (gpiohs_get_pin(rdy_num))
-            break;
-        msleep(1);
+        clk_step--;
+        hard_spi_set_clk_rate(clk_steps[clk_step]);
+#if ESP32_SPI_DEBUG
+        printk("framing errors, spi clk back off to %d\r\n", clk_steps[clk_step]);
+#endif
     }
+}
+
+//Count a clean reply; after ESP32_SPI_LINK_OK_MIN in a row a backed-off
+//clock steps up one notch, so a burst of noise does not cost speed for good
+static void esp32_spi_link_ok(void)
+{
+    link_errors = 0;
+
+    if (!is_hard_spi || clk_training || clk_step >= clk_ceiling)
+        return;
 
-    if ((sysctl_get_time_us() - tm) > 1000 * 1000 * TIMEOUT)
+    if (++link_clean < ESP32_SPI_LINK_OK_MIN)
+        return;
+    link_clean = 0;
+
+    clk_step++;
+    hard_spi_set_clk_rate(clk_steps[clk_step]);
+#if ESP32_SPI_DEBUG
+    printk("link clean, spi clk back up to %d\r\n", clk_steps[clk_step]);
+#endif
+}
+
+///Wait for ready, select the ESP32 and parse the response header
+//burst_len bytes of the frame are read in one go and parsed locally
+//leaves CS asserted on success, the caller reads the params and ends the frame
+//-1 error
+//other number of params in the response
+static int32_t esp32_spi_wait_response_header(uint8_t cmd, uint32_t *num_responses, uint32_t burst_len)
+{
+    esp32_spi_wait_for_ready();
+
+    esp32_spi_select();
+
+    if (esp32_spi_wait_rdy(1, esp32_spi_rdy_budget(1000 * 1000 * TIMEOUT)) != 0)
     {
 #if ESP32_SPI_DEBUG
         printk("ESP32 timed out on SPI select\r\n");
 #endif
-        gpiohs_set_pin(cs_num, 1);
-        return NULL;
+        esp32_spi_read_burst_end();
+        esp32_spi_deselect();
+        return -1;
     }
 
+    esp32_spi_read_burst(burst_len);
+
     if (esp32_spi_wait_spi_char(START_CMD) != 0)
     {
 #if ESP32_SPI_DEBUG
         printk("esp32_spi_wait_spi_char START_CMD error\r\n");
 #endif
-        gpiohs_set_pin(cs_num, 1);
-        return NULL;
+        esp32_spi_link_error();
+        esp32_spi_read_burst_end();
+        esp32_spi_deselect();
+        return -1;
     }
 
     if (esp32_spi_check_data(cmd | REPLY_FLAG) != 0)
@@ -376,8 +607,10 @@ esp32_spi_params_t *esp32_spi_wait_response_cmd(uint8_t cmd, uint32_t *num_respo
 #if ESP32_SPI_DEBUG
         printk("esp32_spi_check_data cmd | REPLY_FLAG error\r\n");
 #endif
-        gpiohs_set_pin(cs_num, 1);
-        return NULL;
+        esp32_spi_link_error();
+        esp32_spi_read_burst_end();
+        esp32_spi_deselect();
+        return -1;
     }
 
     if (num_responses)
@@ -387,15 +620,74 @@ esp32_spi_params_t *esp32_spi_wait_response_cmd(uint8_t cmd, uint32_t *num_respo
 #if ESP32_SPI_DEBUG
             printk("esp32_spi_check_data num_responses error\r\n");
 #endif
-            gpiohs_set_pin(cs_num, 1);
-            return NULL;
+            esp32_spi_read_burst_end();
+            esp32_spi_deselect();
+            return -1;
         }
-        num_of_resp = *num_responses;
+        return *num_responses;
     }
-    else
+
+    return esp32_spi_read_byte();
+}
+
+///Read the length prefix of one response param
+static uint32_t esp32_spi_read_param_len(uint8_t param_len_16)
+{
+    uint32_t len = esp32_spi_read_byte();
+
+    if (param_len_16)
     {
-        num_of_resp = esp32_spi_read_byte();
+        len <<= 8;
+        len |= esp32_spi_read_byte();
     }
+    return len;
+}
+
+///Clock out and drop bytes that do not fit the destination
+static void esp32_spi_skip_bytes(uint32_t len)
+{
+    uint8_t scratch[32];
+
+    while (len)
+    {
+        uint32_t n = len > sizeof(scratch) ? sizeof(scratch) : len;
+        esp32_spi_read_bytes(scratch, n);
+        len -= n;
+    }
+}
+
+///Check the end byte and release CS
+//0 ok
+//-1 error
+static int8_t esp32_spi_wait_response_end(void)
+{
+    uint8_t end = esp32_spi_check_data(END_CMD);
+
+    esp32_spi_read_burst_end();
+
+    if (end != 0)
+    {
+#if ESP32_SPI_DEBUG
+        printk("esp32_spi_check_data END_CMD error\r\n");
+#endif
+        esp32_spi_link_error();
+        esp32_spi_deselect();
+        return -1;
+    }
+
+    esp32_spi_link_ok();
+    esp32_spi_deselect();
+    return 0;
+}
+
+///Wait for ready, then parse the response
+//NULL error
+esp32_spi_params_t *esp32_spi_wait_response_cmd(uint8_t cmd, uint32_t *num_responses, uint8_t param_len_16)
+{
+    int32_t num_of_resp = esp32_spi_wait_response_header(cmd, num_responses, lc_recv_burst_default);
+
+    if (num_of_resp < 0)
+        return NULL;
 
     esp32_spi_params_t *params_ret = (esp32_spi_params_t *)malloc(sizeof(esp32_spi_params_t));
 
@@ -403,16 +695,10 @@ esp32_spi_params_t *esp32_spi_wait_response_cmd(uint8_t cmd, uint32_t *num_respo
     params_ret->params_num = num_of_resp;
     params_ret->params = (void *)malloc(sizeof(void *) * num_of_resp);
 
-    for (uint32_t i = 0; i < num_of_resp; i++)
+    for (uint32_t i = 0; i < (uint32_t)num_of_resp; i++)
     {
         params_ret->params[i] = (esp32_spi_param_t *)malloc(sizeof(esp32_spi_param_t));
-        params_ret->params[i]->param_len = esp32_spi_read_byte();
-
-        if (param_len_16)
-        {
-            params_ret->params[i]->param_len <<= 8;
-            params_ret->params[i]->param_len |= esp32_spi_read_byte();
-        }
+        params_ret->params[i]->param_len = esp32_spi_read_param_len(param_len_16);
 
 #if (ESP32_SPI_DEBUG >= 2)
         printk("\tParameter #%d length is %d\r\n", i, params_ret->params[i]->param_len);
@@ -422,21 +708,54 @@ esp32_spi_params_t *esp32_spi_wait_response_cmd(uint8_t cmd, uint32_t *num_respo
         esp32_spi_read_bytes(params_ret->params[i]->param, params_ret->params[i]->param_len);
     }
 
-    if (esp32_spi_check_data(END_CMD) != 0)
+    if (esp32_spi_wait_response_end() != 0)
     {
-#if ESP32_SPI_DEBUG
-        printk("esp32_spi_check_data END_CMD error\r\n");
-#endif
-        gpiohs_set_pin(cs_num, 1);
+        params_ret->del(params_ret);
         return NULL;
     }
 
-    gpiohs_set_pin(cs_num, 1);
-
     return params_ret;
 }
 
-esp32_spi_params_t *esp32_spi_send_command_get_response(uint8_t cmd, esp32_spi_params_t *params, uint32_t *num_resp, uint8_t sent_param_len_16, uint8_t recv_param_len_16)
+///Wait for ready, then parse the response straight into caller buffers
+//resp[i].param is the destination and resp[i].param_len its capacity on entry,
+//the received length on return; bytes beyond the capacity are dropped.
+//resp_num is the exact number of params expected
+//-1 error
+//other number of params received
+static int32_t esp32_spi_wait_response_into(uint8_t cmd, esp32_spi_param_t *resp, uint32_t resp_num, uint8_t param_len_16)
+{
+    // start, cmd, count, then every length prefix and payload, then end
+    uint32_t frame_len = 3 + 1;
+    for (uint32_t i = 0; i < resp_num; i++)
+        frame_len += (param_len_16 ? 2 : 1) + resp[i].param_len;
+
+    if (esp32_spi_wait_response_header(cmd, &resp_num, frame_len) < 0)
+        return -1;
+
+    for (uint32_t i = 0; i < resp_num; i++)
+    {
+        uint32_t len = esp32_spi_read_param_len(param_len_16);
+        uint32_t keep = len > resp[i].param_len ? resp[i].param_len : len;
+
+#if (ESP32_SPI_DEBUG >= 2)
+        printk("\tParameter #%d length is %d\r\n", i, len);
+#endif
+
+        if (keep)
+            esp32_spi_read_bytes(resp[i].param, keep);
+        if (len > keep)
+            esp32_spi_skip_bytes(len - keep);
+        resp[i].param_len = keep;
+    }
+
+    if (esp32_spi_wait_response_end() != 0)
+        return -1;
+
+    return resp_num;
+}
+
+esp32_spi_params_t *esp32_spi_send_command_get_response(uint8_t cmd, const esp32_spi_param_t *params, uint32_t params_num, uint32_t *num_resp, uint8_t sent_param_len_16, uint8_t recv_param_len_16)
 {
     uint32_t resp_num;
 
@@ -445,10 +764,20 @@ esp32_spi_params_t *esp32_spi_send_command_get_response(uint8_t cmd, esp32_spi_p
     else
         resp_num = *num_resp;
 
-    esp32_spi_send_command(cmd, params, sent_param_len_16);
+    esp32_spi_send_command(cmd, params, params_num, sent_param_len_16);
     return esp32_spi_wait_response_cmd(cmd, &resp_num, recv_param_len_16);
 }
 
+//Same as esp32_spi_send_command_get_response, but without heap allocations:
+//the reply is decoded into the buffers described by resp
+//-1 error
+//other number of params received
+static int32_t esp32_spi_send_command_get_response_into(uint8_t cmd, const esp32_spi_param_t *params, uint32_t params_num, esp32_spi_param_t *resp, uint32_t resp_num, uint8_t sent_param_len_16, uint8_t recv_param_len_16)
+{
+    esp32_spi_send_command(cmd, params, params_num, sent_param_len_16);
+    return esp32_spi_wait_response_into(cmd, resp, resp_num, recv_param_len_16);
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 static void delete_esp32_spi_params(void *arg)
 {
@@ -480,22 +809,22 @@ int8_t esp32_spi_status(void)
     printk("Connection status\r\n");
 #endif
 
-    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(GET_CONN_STATUS_CMD, NULL, NULL, 0, 0);
+    uint8_t stat = WL_NO_MODULE;
+    esp32_spi_param_t resp[] = {{1, &stat}};
 
-    if (resp == NULL)
+    if (esp32_spi_send_command_get_response_into(GET_CONN_STATUS_CMD, NULL, 0, resp, ARRAY_SIZE(resp), 0, 0) < 0)
     {
 #if ESP32_SPI_DEBUG
         printk("%s: get resp error!\r\n", __func__);
 #endif
         return -2;
     }
-    int8_t ret = (int8_t)resp->params[0]->param[0];
+    int8_t ret = (int8_t)stat;
 
 #if ESP32_SPI_DEBUG
     printk("Conn Connection: %s\r\n", wlan_enum_to_str(ret));
 #endif
 
-    resp->del(resp);
     return ret;
 }
 
@@ -508,7 +837,7 @@ char *esp32_spi_firmware_version(char* fw_version)
     printk("Firmware version\r\n");
 #endif
 
-    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(GET_FW_VERSION_CMD, NULL, NULL, 0, 0);
+    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(GET_FW_VERSION_CMD, NULL, 0, NULL, 0, 0);
 
     if (resp == NULL)
     {
@@ -526,46 +855,6 @@ char *esp32_spi_firmware_version(char* fw_version)
     return fw_version;
 }
 
-// make params struct with one param
-static esp32_spi_params_t *esp32_spi_params_alloc_1param(uint32_t len, uint8_t *buf)
-{
-    esp32_spi_params_t *ret = (esp32_spi_params_t *)malloc(sizeof(esp32_spi_params_t));
-
-    ret->del = delete_esp32_spi_params;
-
-    ret->params_num = 1;
-    ret->params = (void *)malloc(sizeof(void *) * ret->params_num);
-    ret->params[0] = (esp32_spi_param_t *)malloc(sizeof(esp32_spi_param_t));
-    ret->params[0]->param_len = len;
-    ret->params[0]->param = (uint8_t *)malloc(sizeof(uint8_t) * len);
-    memcpy(ret->params[0]->param, buf, len);
-
-    return ret;
-}
-
-// make params struct with two param
-static esp32_spi_params_t *esp32_spi_params_alloc_2param(uint32_t len_0, uint8_t *buf_0, uint32_t len_1, uint8_t *buf_1)
-{
-    esp32_spi_params_t *ret = (esp32_spi_params_t *)malloc(sizeof(esp32_spi_params_t));
-
-    ret->del = delete_esp32_spi_params;
-
-    ret->params_num = 2;
-    ret->params = (void *)malloc(sizeof(void *) * ret->params_num);
-    //
-    ret->params[0] = (esp32_spi_param_t *)malloc(sizeof(esp32_spi_param_t));
-    ret->params[0]->param_len = len_0;
-    ret->params[0]->param = (uint8_t *)malloc(sizeof(uint8_t) * len_0);
-    memcpy(ret->params[0]->param, buf_0, len_0);
-    //
-    ret->params[1] = (esp32_spi_param_t *)malloc(sizeof(esp32_spi_param_t));
-    ret->params[1]->param_len = len_1;
-    ret->params[1]->param = (uint8_t *)malloc(sizeof(uint8_t) * len_1);
-    memcpy(ret->params[1]->param, buf_1, len_1);
-
-    return ret;
-}
-
 /// A bytearray containing the MAC address of the ESP32
 //NULL error
 //other ok
@@ -577,9 +866,8 @@ uint8_t *esp32_spi_MAC_address(void)
 
     uint8_t data = 0xff;
 
-    esp32_spi_params_t *send = esp32_spi_params_alloc_1param(1, &data);
-    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(GET_MACADDR_CMD, send, NULL, 0, 0);
-    send->del(send);
+    esp32_spi_param_t send[] = {{1, &data}};
+    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(GET_MACADDR_CMD, send, ARRAY_SIZE(send), NULL, 0, 0);
 
     if (resp == NULL)
     {
@@ -608,7 +896,7 @@ int8_t esp32_spi_start_scan_networks(void)
     printk("Start scan\r\n");
 #endif
 
-    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(START_SCAN_NETWORKS, NULL, NULL, 0, 0);
+    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(START_SCAN_NETWORKS, NULL, 0, NULL, 0, 0);
 
     if (resp == NULL)
     {
@@ -643,57 +931,262 @@ static void delete_esp32_spi_aps_list(void *arg)
     free(aps);
 }
 
+///Fetch the BSSID and/or channel of scan entry idx, as selected by flags
+//(ESP32_SPI_SCAN_BSSID, ESP32_SPI_SCAN_CHANNEL); valid until the next scan
+//a BSSID the firmware does not report is left zeroed
+//-1 error
+//0 ok
+int8_t esp32_spi_get_scan_extras(uint8_t idx, esp32_spi_ap_t *ap, uint8_t flags)
+{
+    esp32_spi_param_t send[] = {{1, &idx}};
+    esp32_spi_param_t bssid[] = {{6, ap->bssid}};
+    esp32_spi_param_t channel[] = {{1, &ap->channel}};
+
+    if (flags & ESP32_SPI_SCAN_BSSID)
+    {
+        if (esp32_spi_send_command_get_response_into(GET_IDX_BSSID_CMD, send, ARRAY_SIZE(send), bssid, ARRAY_SIZE(bssid), 0, 0) < 0)
+            return -1;
+        if (bssid[0].param_len != 6)
+            memset(ap->bssid, 0, sizeof(ap->bssid));
+    }
+
+    if (flags & ESP32_SPI_SCAN_CHANNEL)
+    {
+        if (esp32_spi_send_command_get_response_into(GET_IDX_CHANNEL_CMD, send, ARRAY_SIZE(send), channel, ARRAY_SIZE(channel), 0, 0) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+///Fetch the details of scan entry idx, all allocation free
+//RSSI and encryption always, the rest as selected by flags
+//-1 error
+//0 ok
+static int8_t esp32_spi_get_scan_details(uint8_t idx, esp32_spi_ap_t *ap, uint8_t flags)
+{
+    esp32_spi_param_t send[] = {{1, &idx}};
+    esp32_spi_param_t rssi[] = {{1, (uint8_t *)&ap->rssi}};
+    esp32_spi_param_t encr[] = {{1, &ap->encr}};
+
+    if (esp32_spi_send_command_get_response_into(GET_IDX_RSSI_CMD, send, ARRAY_SIZE(send), rssi, ARRAY_SIZE(rssi), 0, 0) < 0)
+        return -1;
+    if (esp32_spi_send_command_get_response_into(GET_IDX_ENCT_CMD, send, ARRAY_SIZE(send), encr, ARRAY_SIZE(encr), 0, 0) < 0)
+        return -1;
+    if (esp32_spi_get_scan_extras(idx, ap, flags) != 0)
+        return -1;
+
+#if ESP32_SPI_DEBUG
+    printk("\tSSID:%s\t\t\trssi:%d ch:%d\r\n", ap->ssid, ap->rssi, ap->channel);
+#endif
+    return 0;
+}
+
 /*
-The results of the latest SSID scan. Returns a list of dictionaries with
-        'ssid', 'rssi' and 'encryption' entries, one for each AP found
+The results of the latest SSID scan, written to a caller owned array of at
+most max entries. The SSID list is one reply, decoded in place; the firmware
+has no bulk query for the rest, so each entry costs one short allocation free
+round trip per field: RSSI and encryption, plus BSSID and channel when
+selected by flags (ESP32_SPI_SCAN_BSSID, ESP32_SPI_SCAN_CHANNEL). Fields not
+fetched are left zeroed, see esp32_spi_get_scan_extras
 -1 error
-other ok
+other number of entries
 */
-esp32_spi_aps_list_t *esp32_spi_get_scan_networks(void)
+int32_t esp32_spi_get_scan_results(esp32_spi_ap_t *aps, uint32_t max, uint8_t flags)
 {
+    esp32_spi_send_command(SCAN_NETWORKS, NULL, 0, 0);
 
-    esp32_spi_send_command(SCAN_NETWORKS, NULL, 0);
-    esp32_spi_params_t *resp = esp32_spi_wait_response_cmd(SCAN_NETWORKS, NULL, 0);
+    int32_t count = esp32_spi_read_scan_list(aps, max);
 
-    if (resp == NULL)
+    // the SSID reply must be complete before the next command goes out
+    for (int32_t i = 0; i < count; i++)
+    {
+        if (esp32_spi_get_scan_details(i, &aps[i], flags) != 0)
+            return -1;
+    }
+
+    return count;
+}
+
+///Read the SCAN_NETWORKS reply, SSIDs only
+//-1 error
+//other number of entries
+static int32_t esp32_spi_read_scan_list(esp32_spi_ap_t *aps, uint32_t max)
+{
+    int32_t num = esp32_spi_wait_response_header(SCAN_NETWORKS, NULL, lc_recv_burst_default);
+    if (num < 0)
     {
 #if ESP32_SPI_DEBUG
         printk("%s: get resp error!\r\n", __func__);
 #endif
-        return NULL;
+        return -1;
     }
 
-    esp32_spi_aps_list_t *aps = (esp32_spi_aps_list_t *)malloc(sizeof(esp32_spi_aps_list_t));
-    aps->del = delete_esp32_spi_aps_list;
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < (uint32_t)num; i++)
+    {
+        uint32_t len = esp32_spi_read_param_len(0);
+        if (count >= max)
+        {
+            esp32_spi_skip_bytes(len);
+            continue;
+        }
 
-    aps->aps_num = resp->params_num;
-    aps->aps = (void *)malloc(sizeof(void *) * aps->aps_num);
+        uint32_t keep = len > 32 ? 32 : len;
+        memset(&aps[count], 0, sizeof(esp32_spi_ap_t));
+        esp32_spi_read_bytes(aps[count].ssid, keep);
+        esp32_spi_skip_bytes(len - keep);
+        count++;
+    }
 
-    for (uint32_t i = 0; i < aps->aps_num; i++)
+    if (esp32_spi_wait_response_end() != 0)
+        return -1;
+
+    return count;
+}
+
+// background scan, see esp32_spi_scan_async_start
+#define SCAN_IDLE       0
+#define SCAN_LIST_SENT  1   // SCAN_NETWORKS reply owed, the firmware answers when the scan is over
+#define SCAN_DETAILS    2   // fetching per-entry details
+#define SCAN_ABANDONED  3   // SCAN_NETWORKS reply owed but no longer wanted
+static uint8_t scan_state = SCAN_IDLE;
+static esp32_spi_ap_t *scan_aps;
+static uint32_t scan_max, scan_num, scan_next;
+static uint8_t scan_flags;
+static int8_t scan_err;
+
+///Collect an outstanding SCAN_NETWORKS reply, blocking
+static void esp32_spi_scan_complete(void)
+{
+    if (scan_state == SCAN_ABANDONED)
     {
-        aps->aps[i] = (esp32_spi_ap_t *)malloc(sizeof(esp32_spi_ap_t));
-        memcpy(aps->aps[i]->ssid, resp->params[i]->param, (resp->params[i]->param_len > 32) ? 32 : resp->params[i]->param_len);
-        aps->aps[i]->ssid[resp->params[i]->param_len] = 0;
+        // read and discard, the caller's array may be gone
+        esp32_spi_read_scan_list(NULL, 0);
+        scan_state = SCAN_IDLE;
+        return;
+    }
 
-        uint8_t data = i;
-        esp32_spi_params_t *send = esp32_spi_params_alloc_1param(1, &data);
+    if (scan_state != SCAN_LIST_SENT)
+        return;
 
-        esp32_spi_params_t *rssi = esp32_spi_send_command_get_response(GET_IDX_RSSI_CMD, send, NULL, 0, 0);
+    int32_t num = esp32_spi_read_scan_list(scan_aps, scan_max);
+    if (num < 0)
+    {
+        scan_state = SCAN_IDLE;
+        scan_err = -1;
+        return;
+    }
+    scan_num = num;
+    scan_next = 0;
+    scan_state = SCAN_DETAILS;
+}
 
-        aps->aps[i]->rssi = (int8_t)(rssi->params[0]->param[0]);
-#if ESP32_SPI_DEBUG
-	printk("\tSSID:%s", aps->aps[i]->ssid);
-        printk("\t\t\trssi:%02x\r\n", rssi->params[0]->param[0]);
-#endif
-        rssi->del(rssi);
+// Start a scan and return while the firmware is still scanning.
+// aps must stay valid until esp32_spi_scan_async_poll reports completion,
+// flags select the optional fields as for esp32_spi_get_scan_results
+//-1 error
+//0 ok
+int8_t esp32_spi_scan_async_start(esp32_spi_ap_t *aps, uint32_t max, uint8_t flags)
+{
+    // a previous scan may still owe its reply
+    esp32_spi_scan_complete();
+    scan_state = SCAN_IDLE;
+    scan_err = 0;
 
-        esp32_spi_params_t *encr = esp32_spi_send_command_get_response(GET_IDX_ENCT_CMD, send, NULL, 0, 0);
-        aps->aps[i]->encr = encr->params[0]->param[0];
-        encr->del(encr);
+    if (esp32_spi_start_scan_networks() != 0)
+        return -1;
+
+    scan_aps = aps;
+    scan_max = max;
+    scan_num = 0;
+    scan_flags = flags;
+    if (esp32_spi_send_command(SCAN_NETWORKS, NULL, 0, 0) < 0)
+        return -1;
+
+    scan_state = SCAN_LIST_SENT;
+    return 0;
+}
 
-        send->del(send);
+// Advance a background scan by at most one step: the SSID list once the
+// ready pin shows the firmware has it, then one entry's details per call
+//-1 error
+//other number of entries complete so far, *done is set once all are
+int32_t esp32_spi_scan_async_poll(uint8_t *done)
+{
+    *done = 0;
+
+    if (scan_state == SCAN_LIST_SENT)
+    {
+        if (gpiohs_get_pin(rdy_num) != 0)
+            return 0;
+        esp32_spi_scan_complete();
+    }
+    else if (scan_state == SCAN_DETAILS && scan_next < scan_num)
+    {
+        if (esp32_spi_get_scan_details(scan_next, &scan_aps[scan_next], scan_flags) != 0)
+        {
+            scan_state = SCAN_IDLE;
+            scan_err = -1;
+        }
+        scan_next++;
+    }
+
+    if (scan_err)
+        return -1;
+
+    if (scan_state == SCAN_DETAILS && scan_next >= scan_num)
+    {
+        scan_state = SCAN_IDLE;
+        *done = 1;
+        return scan_num;
+    }
+
+    return scan_state == SCAN_DETAILS ? (int32_t)scan_next : 0;
+}
+
+// Give up on a background scan, the aps array is not written after this.
+// A SCAN_NETWORKS reply the firmware still owes is discarded now if it is
+// ready, otherwise before the next command goes out
+void esp32_spi_scan_async_cancel(void)
+{
+    if (scan_state == SCAN_LIST_SENT)
+    {
+        scan_state = SCAN_ABANDONED;
+        if (gpiohs_get_pin(rdy_num) == 0)
+            esp32_spi_scan_complete();
+    }
+    else if (scan_state == SCAN_DETAILS)
+    {
+        scan_state = SCAN_IDLE;
+    }
+}
+
+/*
+The results of the latest SSID scan. Returns a list of dictionaries with
+        'ssid', 'rssi' and 'encryption' entries, one for each AP found
+-1 error
+other ok
+*/
+esp32_spi_aps_list_t *esp32_spi_get_scan_networks(void)
+{
+    esp32_spi_ap_t found[WL_NETWORKS_LIST_MAXNUM];
+    int32_t num = esp32_spi_get_scan_results(found, WL_NETWORKS_LIST_MAXNUM, 0);
+
+    if (num < 0)
+        return NULL;
+
+    esp32_spi_aps_list_t *aps = (esp32_spi_aps_list_t *)malloc(sizeof(esp32_spi_aps_list_t));
+    aps->del = delete_esp32_spi_aps_list;
+
+    aps->aps_num = num;
+    aps->aps = (void *)malloc(sizeof(void *) * aps->aps_num);
+
+    for (uint32_t i = 0; i < aps->aps_num; i++)
+    {
+        aps->aps[i] = (esp32_spi_ap_t *)malloc(sizeof(esp32_spi_ap_t));
+        *aps->aps[i] = found[i];
     }
-    resp->del(resp);
 
     return aps;
 }
@@ -740,9 +1233,8 @@ esp32_spi_aps_list_t *esp32_spi_scan_networks(void)
  */
 int8_t esp32_spi_wifi_set_network(uint8_t *ssid)
 {
-    esp32_spi_params_t *send = esp32_spi_params_alloc_1param(strlen((const char*)ssid), ssid);
-    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(SET_NET_CMD, send, NULL, 0, 0);
-    send->del(send);
+    esp32_spi_param_t send[] = {{strlen((const char*)ssid), ssid}};
+    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(SET_NET_CMD, send, ARRAY_SIZE(send), NULL, 0, 0);
 
     if (resp == NULL)
     {
@@ -773,9 +1265,8 @@ Sets the desired access point ssid and passphrase
 */
 int8_t esp32_spi_wifi_wifi_set_passphrase(uint8_t *ssid, uint8_t *passphrase)
 {
-    esp32_spi_params_t *send = esp32_spi_params_alloc_2param(strlen((const char*)ssid), ssid, strlen((const char*)passphrase), passphrase);
-    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(SET_PASSPHRASE_CMD, send, NULL, 0, 0);
-    send->del(send);
+    esp32_spi_param_t send[] = {{strlen((const char*)ssid), ssid}, {strlen((const char*)passphrase), passphrase}};
+    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(SET_PASSPHRASE_CMD, send, ARRAY_SIZE(send), NULL, 0, 0);
 
     if (resp == NULL)
     {
@@ -808,11 +1299,8 @@ char *esp32_spi_get_ssid(void)
 
     uint8_t data = 0xff;
 
-    esp32_spi_params_t *send = esp32_spi_params_alloc_1param(1, &data);
-
-    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(GET_CURR_SSID_CMD, send, NULL, 0, 0);
-
-    send->del(send);
+    esp32_spi_param_t send[] = {{1, &data}};
+    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(GET_CURR_SSID_CMD, send, ARRAY_SIZE(send), NULL, 0, 0);
 
     if (resp == NULL)
     {
@@ -834,20 +1322,134 @@ char *esp32_spi_get_ssid(void)
 }
 
 /*
-The receiving signal strength indicator for the access point we're connected to
+The receiving signal strength indicator for the access point we're connected to
+-1 error
+other ok
+*/
+int8_t esp32_spi_get_rssi(void)
+{
+    uint8_t data = 0xff;
+    esp32_spi_param_t send[] = {{1, &data}};
+    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(GET_CURR_RSSI_CMD, send, ARRAY_SIZE(send), NULL, 0, 0);
+
+    if (resp == NULL)
+    {
+#if ESP32_SPI_DEBUG
+        printk("%s: get resp error!\r\n", __func__);
+#endif
+        return -1;
+    }
+
+    int8_t r = (int8_t)(resp->params[0]->param[0]);
+    resp->del(resp);
+
+#if ESP32_SPI_DEBUG
+    printk("connect rssi:%d\r\n", r);
+#endif
+
+    return r;
+}
+
+/*
+A dictionary containing current connection details such as the 'ip_addr',
+        'netmask' and 'gateway
+    net_data[0]     ip_addr
+    net_data[1]     netmask
+    net_data[2]     gateway
+*/
+// NULL error
+// other ok
+esp32_spi_net_t *esp32_spi_get_network_data(void)
+{
+    uint8_t data = 0xff;
+    uint32_t num_resp = 3;
+
+    esp32_spi_param_t send[] = {{1, &data}};
+    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(GET_IPADDR_CMD, send, ARRAY_SIZE(send), &num_resp, 0, 0);
+
+    if (resp == NULL)
+    {
+#if ESP32_SPI_DEBUG
+        printk("%s: get resp error!\r\n", __func__);
+#endif
+        return NULL;
+    }
+
+    if (resp->params_num != 3)
+    {
+#if ESP32_SPI_DEBUG
+        printk("%s: resp->params_num  error!\r\n", __func__);
+#endif
+        resp->del(resp);
+        return NULL;
+    }
+
+    memcpy(net_dat.localIp, resp->params[0]->param, resp->params[0]->param_len);
+    memcpy(net_dat.subnetMask, resp->params[1]->param, resp->params[1]->param_len);
+    memcpy(net_dat.gatewayIp, resp->params[2]->param, resp->params[2]->param_len);
+
+    resp->del(resp);
+
+    return &net_dat;
+}
+
+/*
+Use a static address instead of DHCP, applied on the next connect.
+valid_params is the number of leading addresses that are set (1-3);
+the firmware takes all three, so unset ones are derived from ip as
+gateway x.x.x.1 and netmask 255.255.255.0
+-1 error
+0 ok
+*/
+int8_t esp32_spi_set_ip_config(uint8_t valid_params, uint8_t *ip, uint8_t *gateway, uint8_t *subnet)
+{
+    uint8_t gw[4] = {ip[0], ip[1], ip[2], 1};
+    uint8_t mask[4] = {255, 255, 255, 0};
+
+    if (valid_params >= 2)
+        memcpy(gw, gateway, 4);
+    if (valid_params >= 3)
+        memcpy(mask, subnet, 4);
+
+    esp32_spi_param_t send[] = {{1, &valid_params}, {4, ip}, {4, gw}, {4, mask}};
+
+    uint8_t ok = 0;
+    esp32_spi_param_t resp[] = {{1, &ok}};
+
+    if (esp32_spi_send_command_get_response_into(SET_IP_CONFIG_CMD, send, ARRAY_SIZE(send), resp, ARRAY_SIZE(resp), 0, 0) < 0)
+    {
+#if ESP32_SPI_DEBUG
+        printk("%s: get resp error!\r\n", __func__);
+#endif
+        return -1;
+    }
+
+    if (ok != 1)
+    {
+#if ESP32_SPI_DEBUG
+        printk("%s: Failed to set ip config\r\n", __func__);
+#endif
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+Set the DNS servers (valid_params 1 or 2, dns2 may be NULL for 1)
 -1 error
-other ok
+0 ok
 */
-int8_t esp32_spi_get_rssi(void)
+int8_t esp32_spi_set_dns_config(uint8_t valid_params, uint8_t *dns1, uint8_t *dns2)
 {
-    uint8_t data = 0xff;
-    esp32_spi_params_t *send = esp32_spi_params_alloc_1param(1, &data);
+    uint8_t none[4] = {0, 0, 0, 0};
 
-    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(GET_CURR_RSSI_CMD, send, NULL, 0, 0);
+    esp32_spi_param_t send[] = {{1, &valid_params}, {4, dns1}, {4, (valid_params >= 2 && dns2) ? dns2 : none}};
 
-    send->del(send);
+    uint8_t ok = 0;
+    esp32_spi_param_t resp[] = {{1, &ok}};
 
-    if (resp == NULL)
+    if (esp32_spi_send_command_get_response_into(SET_DNS_CONFIG_CMD, send, ARRAY_SIZE(send), resp, ARRAY_SIZE(resp), 0, 0) < 0)
     {
 #if ESP32_SPI_DEBUG
         printk("%s: get resp error!\r\n", __func__);
@@ -855,65 +1457,61 @@ int8_t esp32_spi_get_rssi(void)
         return -1;
     }
 
-    int8_t r = (int8_t)(resp->params[0]->param[0]);
-    resp->del(resp);
-
+    if (ok != 1)
+    {
 #if ESP32_SPI_DEBUG
-    printk("connect rssi:%d\r\n", r);
+        printk("%s: Failed to set dns config\r\n", __func__);
 #endif
+        return -1;
+    }
 
-    return r;
+    // cached answers came from the old servers
+    esp32_spi_dns_cache_flush();
+    return 0;
 }
 
 /*
-A dictionary containing current connection details such as the 'ip_addr',
-        'netmask' and 'gateway
-    net_data[0]     ip_addr
-    net_data[1]     netmask
-    net_data[2]     gateway
+Set the DHCP host name, applied on the next connect; at most
+ESP32_SPI_HOSTNAME_MAX characters
+-1 error
+0 ok
 */
-// NULL error
-// other ok
-esp32_spi_net_t *esp32_spi_get_network_data(void)
+int8_t esp32_spi_set_hostname(uint8_t *hostname)
 {
-    uint8_t data = 0xff;
-    uint32_t num_resp = 3;
+    size_t len = strlen((const char*)hostname);
 
-    esp32_spi_params_t *send = esp32_spi_params_alloc_1param(1, &data);
-    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(GET_IPADDR_CMD, send, &num_resp, 0, 0);
-    send->del(send);
+    if (len == 0 || len > ESP32_SPI_HOSTNAME_MAX)
+        return -1;
 
-    if (resp == NULL)
+    esp32_spi_param_t send[] = {{len, hostname}};
+
+    uint8_t ok = 0;
+    esp32_spi_param_t resp[] = {{1, &ok}};
+
+    if (esp32_spi_send_command_get_response_into(SET_HOSTNAME_CMD, send, ARRAY_SIZE(send), resp, ARRAY_SIZE(resp), 0, 0) < 0)
     {
 #if ESP32_SPI_DEBUG
         printk("%s: get resp error!\r\n", __func__);
 #endif
-        return NULL;
+        return -1;
     }
 
-    if (resp->params_num != 3)
+    if (ok != 1)
     {
 #if ESP32_SPI_DEBUG
-        printk("%s: resp->params_num  error!\r\n", __func__);
+        printk("%s: Failed to set hostname\r\n", __func__);
 #endif
-        resp->del(resp);
-        return NULL;
+        return -1;
     }
 
-    memcpy(net_dat.localIp, resp->params[0]->param, resp->params[0]->param_len);
-    memcpy(net_dat.subnetMask, resp->params[1]->param, resp->params[1]->param_len);
-    memcpy(net_dat.gatewayIp, resp->params[2]->param, resp->params[2]->param_len);
-
-    resp->del(resp);
-
-    return &net_dat;
+    return 0;
 }
 
 /// Our local IP address
-//use esp32_spi_get_network_data to get
+//use a static address, gateway and netmask derived from it
 int8_t esp32_spi_ip_address(uint8_t *net_data)
 {
-    return 0;
+    return esp32_spi_set_ip_config(1, net_data, NULL, NULL);
 }
 
 //Whether the ESP32 is connected to an access point
@@ -945,24 +1543,41 @@ void esp32_spi_connect(uint8_t *secrets)
     return;
 }
 
-//Connect to an access point with given name and password.
-//      Will retry up to 10 times and return on success or raise
-//      an exception on failure
-//-1 connect failed
-//0 connect succ
-int8_t esp32_spi_connect_AP(uint8_t *ssid, uint8_t *password, uint8_t retry_times)
+// Hand the credentials to the firmware, which then joins on its own;
+// follow progress with esp32_spi_status
+//-1 error
+//0 ok
+int8_t esp32_spi_connect_AP_start(uint8_t *ssid, uint8_t *password)
 {
 #if ESP32_SPI_DEBUG
     printk("Connect to AP--> ssid: %s password:%s\r\n", ssid, password);
 #endif
+    // names may resolve differently on the new network
+    esp32_spi_dns_cache_flush();
+
     if (password)
-        esp32_spi_wifi_wifi_set_passphrase(ssid, password);
+        return esp32_spi_wifi_wifi_set_passphrase(ssid, password);
     else
-        esp32_spi_wifi_set_network(ssid);
+        return esp32_spi_wifi_set_network(ssid);
+}
+
+//Connect to an access point with given name and password (NULL for an open one).
+//      Waits up to retry_times seconds, polling the status every
+//      ESP32_SPI_CONNECT_AP_POLL_MS so a join is seen as soon as it happens
+//0 connected
+//-1 status error, the module was reset
+//-2 the firmware reported the connect failed
+//-3 failed, lost or disconnected when the wait ran out
+//-4 no such ssid
+//-5 other status when the wait ran out
+int8_t esp32_spi_connect_AP(uint8_t *ssid, uint8_t *password, uint8_t retry_times)
+{
+    esp32_spi_connect_AP_start(ssid, password);
 
     int8_t stat = -1;
+    uint32_t polls = (uint32_t)retry_times * 1000 / ESP32_SPI_CONNECT_AP_POLL_MS;
 
-    for (uint8_t i = 0; i < retry_times; i++)
+    for (uint32_t i = 0; i < polls; i++)
     {
         stat = esp32_spi_status();
 
@@ -978,7 +1593,7 @@ int8_t esp32_spi_connect_AP(uint8_t *ssid, uint8_t *password, uint8_t retry_time
             return 0;
         else if (stat == WL_CONNECT_FAILED)
             return -2;
-        sleep(1);
+        msleep(ESP32_SPI_CONNECT_AP_POLL_MS);
     }
     stat = esp32_spi_status();
 
@@ -1009,7 +1624,7 @@ int8_t esp32_spi_connect_AP(uint8_t *ssid, uint8_t *password, uint8_t retry_time
 
 int8_t esp32_spi_disconnect_from_AP(void)
 {
-    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(DISCONNECT_CMD, NULL, NULL, 0, 0);
+    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(DISCONNECT_CMD, NULL, 0, NULL, 0, 0);
     if (resp == NULL)
     {
         return -1;
@@ -1032,20 +1647,98 @@ void esp32_spi_unpretty_ip(uint8_t *ip)
     return;
 }
 
-//Convert a hostname to a packed 4-byte IP address. Returns a 4 bytearray
-//-1 error
-//0 ok
-int esp32_spi_get_host_by_name(uint8_t *hostname, uint8_t *ip)
+// hostname -> IPv4 cache, least recently used entry is replaced
+typedef struct
 {
-#if ESP32_SPI_DEBUG
-    printk("*** Get host by name\r\n");
-#endif
+    char host[ESP32_SPI_DNS_NAME_MAX];   // empty if the slot is free
+    uint8_t ip[4];
+    int err;                             // errno of a failed lookup, 0 if ip is valid
+    uint64_t expires_us;
+    uint64_t used_us;
+} dns_cache_entry_t;
+
+static dns_cache_entry_t dns_cache[ESP32_SPI_DNS_CACHE_SIZE];
+static uint32_t dns_ttl_s = ESP32_SPI_DNS_TTL_S;
+static uint32_t dns_neg_ttl_s = ESP32_SPI_DNS_NEG_TTL_S;
+
+void esp32_spi_dns_cache_config(uint32_t ttl_s, uint32_t neg_ttl_s)
+{
+    dns_ttl_s = ttl_s;
+    dns_neg_ttl_s = neg_ttl_s;
+    esp32_spi_dns_cache_flush();
+}
 
-    esp32_spi_params_t *send = esp32_spi_params_alloc_1param(strlen((const char*)hostname), hostname);
-    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(REQ_HOST_BY_NAME_CMD, send, NULL, 0, 0);
-    send->del(send);
+void esp32_spi_dns_cache_flush(void)
+{
+    memset(dns_cache, 0, sizeof(dns_cache));
+}
 
-    if (resp == NULL)
+static dns_cache_entry_t *dns_cache_find(const char *host)
+{
+    uint64_t now = sysctl_get_time_us();
+
+    for (uint32_t i = 0; i < ESP32_SPI_DNS_CACHE_SIZE; i++)
+    {
+        dns_cache_entry_t *e = &dns_cache[i];
+        if (e->host[0] == 0 || strcmp(e->host, host) != 0)
+            continue;
+        if (now >= e->expires_us)
+        {
+            e->host[0] = 0;
+            return NULL;
+        }
+        e->used_us = now;
+        return e;
+    }
+    return NULL;
+}
+
+static void dns_cache_store(const char *host, const uint8_t *ip, int err)
+{
+    uint32_t ttl_s = err ? dns_neg_ttl_s : dns_ttl_s;
+    if (ttl_s == 0 || strlen(host) >= ESP32_SPI_DNS_NAME_MAX)
+        return;
+
+    // a free slot, or else the least recently used one
+    dns_cache_entry_t *e = &dns_cache[0];
+    for (uint32_t i = 0; i < ESP32_SPI_DNS_CACHE_SIZE; i++)
+    {
+        if (dns_cache[i].host[0] == 0)
+        {
+            e = &dns_cache[i];
+            break;
+        }
+        if (dns_cache[i].used_us < e->used_us)
+            e = &dns_cache[i];
+    }
+
+    uint64_t now = sysctl_get_time_us();
+    strcpy(e->host, host);
+    if (ip)
+        memcpy(e->ip, ip, 4);
+    e->err = err;
+    e->used_us = now;
+    e->expires_us = now + (uint64_t)ttl_s * 1000 * 1000;
+}
+
+// REQ_HOST_BY_NAME_CMD sent but its reply not read yet, see esp32_spi_resolve_start
+#define DNS_IDLE        0
+#define DNS_REQ_SENT    1
+#define DNS_DONE        2
+static uint8_t dns_state = DNS_IDLE;
+static char dns_host[ESP32_SPI_DNS_NAME_MAX];
+static uint8_t dns_ip[4];
+static int dns_err;
+
+///Read the REQ_HOST_BY_NAME_CMD reply, then fetch and cache the result
+//0 ok
+//other errno
+static int esp32_spi_resolve_finish(const char *hostname, uint8_t *ip)
+{
+    uint8_t ok = 0;
+    esp32_spi_param_t resp_ok[] = {{1, &ok}};
+
+    if (esp32_spi_wait_response_into(REQ_HOST_BY_NAME_CMD, resp_ok, ARRAY_SIZE(resp_ok), 0) < 0)
     {
 #if ESP32_SPI_DEBUG
         printk("%s: get resp error!\r\n", __func__);
@@ -1053,19 +1746,19 @@ int esp32_spi_get_host_by_name(uint8_t *hostname, uint8_t *ip)
         return EIO;
     }
 
-    if (resp->params[0]->param[0] != 1)
+    if (ok != 1)
     {
 #if ESP32_SPI_DEBUG
         printk("Failed to request hostname\r\n");
 #endif
-        resp->del(resp);
+        // refused (not associated, say), not an answer about the name: don't cache
         return EINVAL;
     }
-    resp->del(resp);
 
-    resp = esp32_spi_send_command_get_response(GET_HOST_BY_NAME_CMD, NULL, NULL, 0, 0);
+    uint8_t res[4];
+    esp32_spi_param_t resp_ip[] = {{4, res}};
 
-    if (resp == NULL)
+    if (esp32_spi_send_command_get_response_into(GET_HOST_BY_NAME_CMD, NULL, 0, resp_ip, ARRAY_SIZE(resp_ip), 0, 0) < 0)
     {
 #if ESP32_SPI_DEBUG
         printk("%s: get resp error!\r\n", __func__);
@@ -1074,22 +1767,130 @@ int esp32_spi_get_host_by_name(uint8_t *hostname, uint8_t *ip)
     }
 
 #if (ESP32_SPI_DEBUG >= 2)
-    printk("get_host_by_name:%s-->", hostname);
-    for (uint8_t i = 0; i < resp->params[0]->param_len; i++)
+    printk("get_host_by_name:%s-->%d.%d.%d.%d\r\n", hostname, res[0], res[1], res[2], res[3]);
+#endif
+
+    // the firmware answers 0.0.0.0 or 255.255.255.255 when the lookup failed
+    uint32_t addr = res[0] | res[1] << 8 | res[2] << 16 | (uint32_t)res[3] << 24;
+    if (resp_ip[0].param_len != 4 || addr == 0 || addr == 0xffffffff)
+    {
+        dns_cache_store(hostname, NULL, EINVAL);
+        return EINVAL;
+    }
+
+    memcpy(ip, res, 4);
+    dns_cache_store(hostname, ip, 0);
+
+    return 0;
+}
+
+///Collect an outstanding split-phase lookup, blocking; any other command
+//must wait for it since the firmware answers requests in order
+static void esp32_spi_resolve_complete(void)
+{
+    if (dns_state != DNS_REQ_SENT)
+        return;
+
+    dns_state = DNS_DONE;
+    dns_err = esp32_spi_resolve_finish(dns_host, dns_ip);
+}
+
+//Convert a hostname to a packed 4-byte IP address, written to ip.
+// served from the cache while an entry is fresh, failures are cached too
+// (for ESP32_SPI_DNS_NEG_TTL_S) so an unreachable name is not retried on
+// every reconnect; bus errors and refused requests are never cached
+//0 ok
+//EINVAL the name did not resolve, or the firmware refused the request
+//EIO bus error
+int esp32_spi_get_host_by_name(uint8_t *hostname, uint8_t *ip)
+{
+    dns_cache_entry_t *cached = dns_cache_find((const char *)hostname);
+    if (cached)
     {
-        printk("%d", resp->params[0]->param[i]);
-        if (i < resp->params[0]->param_len - 1)
-            printk(".");
+        if (cached->err == 0)
+            memcpy(ip, cached->ip, 4);
+        return cached->err;
     }
-    printk("\r\n");
+
+#if ESP32_SPI_DEBUG
+    printk("*** Get host by name\r\n");
 #endif
 
-    memcpy(ip, resp->params[0]->param, resp->params[0]->param_len);
-    resp->del(resp);
+    esp32_spi_param_t send[] = {{strlen((const char*)hostname), hostname}};
+    if (esp32_spi_send_command(REQ_HOST_BY_NAME_CMD, send, ARRAY_SIZE(send), 0) < 0)
+        return EIO;
+
+    return esp32_spi_resolve_finish((const char *)hostname, ip);
+}
+
+// Start resolving hostname without waiting for the firmware's resolver,
+// collect the answer with esp32_spi_resolve_poll
+//0 started
+//other errno
+int esp32_spi_resolve_start(uint8_t *hostname)
+{
+    esp32_spi_resolve_complete();
+    dns_state = DNS_IDLE;
+
+    dns_cache_entry_t *cached = dns_cache_find((const char *)hostname);
+    if (cached || strlen((const char *)hostname) >= ESP32_SPI_DNS_NAME_MAX)
+    {
+        // a hit, or a name the state cannot hold: answer right away
+        dns_err = esp32_spi_get_host_by_name(hostname, dns_ip);
+        dns_state = DNS_DONE;
+        return 0;
+    }
+
+    strcpy(dns_host, (const char *)hostname);
+
+    esp32_spi_param_t send[] = {{strlen((const char*)hostname), hostname}};
+    if (esp32_spi_send_command(REQ_HOST_BY_NAME_CMD, send, ARRAY_SIZE(send), 0) < 0)
+        return EIO;
 
+    dns_state = DNS_REQ_SENT;
     return 0;
 }
 
+// The firmware holds the ready pin high while it resolves, so a pending
+// lookup is detected without touching the bus
+//0 ok, ip is set
+//1 pending
+//other errno
+int esp32_spi_resolve_poll(uint8_t *ip)
+{
+    if (dns_state == DNS_IDLE)
+        return EINVAL;
+
+    if (dns_state == DNS_REQ_SENT)
+    {
+        if (gpiohs_get_pin(rdy_num) != 0)
+            return 1;
+        esp32_spi_resolve_complete();
+    }
+
+    dns_state = DNS_IDLE;
+    if (dns_err == 0)
+        memcpy(ip, dns_ip, 4);
+    return dns_err;
+}
+
+// Forget replies owed by a lookup or scan, the firmware is being reset;
+// their polls then report an error
+static void esp32_spi_drop_pending(void)
+{
+    if (dns_state == DNS_REQ_SENT)
+    {
+        dns_state = DNS_DONE;
+        dns_err = EIO;
+    }
+
+    if (scan_state != SCAN_IDLE)
+    {
+        scan_state = SCAN_IDLE;
+        scan_err = -1;
+    }
+}
+
 #define MAX(a, b) (a) > (b) ? (a) : (b)
 #define MIN(a, b) (a) < (b) ? (a) : (b)
 
@@ -1125,9 +1926,8 @@ int32_t esp32_spi_ping(uint8_t *dest, uint8_t dest_type, uint8_t ttl)
         memcpy(dest_array, dest, 4);
     }
 
-    esp32_spi_params_t *send = esp32_spi_params_alloc_2param(4, dest_array, 1, &sttl);
-    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(PING_CMD, send, NULL, 0, 0);
-    send->del(send);
+    esp32_spi_param_t send[] = {{4, dest_array}, {1, &sttl}};
+    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(PING_CMD, send, ARRAY_SIZE(send), NULL, 0, 0);
 
     if (resp == NULL)
     {
@@ -1156,9 +1956,10 @@ uint8_t esp32_spi_get_socket(void)
 #if ESP32_SPI_DEBUG
     printk("*** Get socket\r\n");
 #endif
-    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(GET_SOCKET_CMD, NULL, NULL, 0, 0);
+    uint8_t socket = 0xff;
+    esp32_spi_param_t resp[] = {{1, &socket}};
 
-    if (resp == NULL)
+    if (esp32_spi_send_command_get_response_into(GET_SOCKET_CMD, NULL, 0, resp, ARRAY_SIZE(resp), 0, 0) < 0)
     {
 #if ESP32_SPI_DEBUG
         printk("%s: get resp error!\r\n", __func__);
@@ -1166,14 +1967,11 @@ uint8_t esp32_spi_get_socket(void)
         return 0xff;
     }
 
-    uint8_t socket = resp->params[0]->param[0];
-
     if (socket == 255)
     {
 #if ESP32_SPI_DEBUG
         printk("No sockets available\r\n");
 #endif
-        resp->del(resp);
         return 0xff;
     }
 
@@ -1181,7 +1979,6 @@ uint8_t esp32_spi_get_socket(void)
     printk("Allocated socket #%d\r\n", socket);
 #endif
 
-    resp->del(resp);
     return (int16_t)socket;
 }
 
@@ -1208,79 +2005,26 @@ int8_t esp32_spi_socket_open(uint8_t sock_num, uint8_t *dest, uint8_t dest_type,
     printk("port: 0x%02x 0x%02x\r\n", port_arr[0], port_arr[1]);
 #endif
 
-    esp32_spi_params_t *send = (esp32_spi_params_t *)malloc(sizeof(esp32_spi_params_t));
-    send->del = delete_esp32_spi_params;
+    uint8_t ip_any[4] = {0, 0, 0, 0};
+    uint8_t mode = (uint8_t)conn_mode;
 
-    uint32_t param_len = 0;
+    esp32_spi_param_t send[5];
+    uint32_t send_num = 0;
 
     if (dest_type)
     {
-        send->params_num = 5;
-        send->params = (void *)malloc(sizeof(void *) * send->params_num);
-        //
-        param_len = strlen((const char*)dest);
-        send->params[0] = (esp32_spi_param_t *)malloc(sizeof(esp32_spi_param_t));
-        send->params[0]->param_len = param_len;
-        send->params[0]->param = (uint8_t *)malloc(sizeof(uint8_t) * param_len);
-        memcpy(send->params[0]->param, dest, param_len);
-        //
-        param_len = 4;
-        send->params[1] = (esp32_spi_param_t *)malloc(sizeof(esp32_spi_param_t));
-        send->params[1]->param_len = param_len;
-        send->params[1]->param = (uint8_t *)malloc(sizeof(uint8_t) * param_len);
-        memset(send->params[1]->param, 0, param_len);
-        //
-        param_len = 2;
-        send->params[2] = (esp32_spi_param_t *)malloc(sizeof(esp32_spi_param_t));
-        send->params[2]->param_len = param_len;
-        send->params[2]->param = (uint8_t *)malloc(sizeof(uint8_t) * param_len);
-        memcpy(send->params[2]->param, port_arr, param_len);
-        //
-        param_len = 1;
-        send->params[3] = (esp32_spi_param_t *)malloc(sizeof(esp32_spi_param_t));
-        send->params[3]->param_len = param_len;
-        send->params[3]->param = (uint8_t *)malloc(sizeof(uint8_t) * param_len);
-        send->params[3]->param[0] = sock_num;
-        //
-        param_len = 1;
-        send->params[4] = (esp32_spi_param_t *)malloc(sizeof(esp32_spi_param_t));
-        send->params[4]->param_len = param_len;
-        send->params[4]->param = (uint8_t *)malloc(sizeof(uint8_t) * param_len);
-        send->params[4]->param[0] = conn_mode;
+        send[send_num++] = (esp32_spi_param_t){strlen((const char*)dest), dest};
+        send[send_num++] = (esp32_spi_param_t){4, ip_any};
     }
     else
     {
-        send->params_num = 4;
-        send->params = (void *)malloc(sizeof(void *) * send->params_num);
-        //
-        param_len = 4;
-        send->params[0] = (esp32_spi_param_t *)malloc(sizeof(esp32_spi_param_t));
-        send->params[0]->param_len = param_len;
-        send->params[0]->param = (uint8_t *)malloc(sizeof(uint8_t) * param_len);
-        memcpy(send->params[0]->param, dest, param_len);
-        //
-        param_len = 2;
-        send->params[1] = (esp32_spi_param_t *)malloc(sizeof(esp32_spi_param_t));
-        send->params[1]->param_len = param_len;
-        send->params[1]->param = (uint8_t *)malloc(sizeof(uint8_t) * param_len);
-        memcpy(send->params[1]->param, port_arr, param_len);
-        //
-        param_len = 1;
-        send->params[2] = (esp32_spi_param_t *)malloc(sizeof(esp32_spi_param_t));
-        send->params[2]->param_len = param_len;
-        send->params[2]->param = (uint8_t *)malloc(sizeof(uint8_t) * param_len);
-        send->params[2]->param[0] = sock_num;
-        //
-        param_len = 1;
-        send->params[3] = (esp32_spi_param_t *)malloc(sizeof(esp32_spi_param_t));
-        send->params[3]->param_len = param_len;
-        send->params[3]->param = (uint8_t *)malloc(sizeof(uint8_t) * param_len);
-        send->params[3]->param[0] = conn_mode;
-    }
-
-    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(START_CLIENT_TCP_CMD, send, NULL, 0, 0);
-
-    send->del(send);
+        send[send_num++] = (esp32_spi_param_t){4, dest};
+    }
+    send[send_num++] = (esp32_spi_param_t){2, port_arr};
+    send[send_num++] = (esp32_spi_param_t){1, &sock_num};
+    send[send_num++] = (esp32_spi_param_t){1, &mode};
+
+    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(START_CLIENT_TCP_CMD, send, send_num, NULL, 0, 0);
 
     if (resp == NULL)
     {
@@ -1311,11 +2055,11 @@ int8_t esp32_spi_socket_open(uint8_t sock_num, uint8_t *dest, uint8_t dest_type,
 // enum ok
 esp32_socket_enum_t esp32_spi_socket_status(uint8_t socket_num)
 {
-    esp32_spi_params_t *send = esp32_spi_params_alloc_1param(1, &socket_num);
-    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(GET_CLIENT_STATE_TCP_CMD, send, NULL, 0, 0);
-    send->del(send);
+    uint8_t stat = SOCKET_CLOSED;
+    esp32_spi_param_t send[] = {{1, &socket_num}};
+    esp32_spi_param_t resp[] = {{1, &stat}};
 
-    if (resp == NULL)
+    if (esp32_spi_send_command_get_response_into(GET_CLIENT_STATE_TCP_CMD, send, ARRAY_SIZE(send), resp, ARRAY_SIZE(resp), 0, 0) < 0)
     {
 #if ESP32_SPI_DEBUG
         printk("%s: get resp error!\r\n", __func__);
@@ -1324,9 +2068,7 @@ esp32_socket_enum_t esp32_spi_socket_status(uint8_t socket_num)
     }
     esp32_socket_enum_t ret;
 
-    ret = (esp32_socket_enum_t)resp->params[0]->param[0];
-
-    resp->del(resp);
+    ret = (esp32_socket_enum_t)stat;
 
 #if (ESP32_SPI_DEBUG > 1)
     printk("sock stat :%d\r\n", ret);
@@ -1341,37 +2083,33 @@ uint8_t esp32_spi_socket_connected(uint8_t socket_num)
 }
 
 //Write the bytearray buffer to a socket
-//0 error
-//len ok
-uint32_t esp32_spi_socket_write(uint8_t socket_num, uint8_t *buffer, uint16_t len)
+//-1 error
+//0 the firmware's socket buffer is full (it never blocks)
+//other number of bytes the firmware accepted
+int32_t esp32_spi_socket_write(uint8_t socket_num, uint8_t *buffer, uint16_t len)
 {
-    esp32_spi_params_t *send = esp32_spi_params_alloc_2param(1, &socket_num, len, buffer);
-    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(SEND_DATA_TCP_CMD, send, NULL, 1, 0);
-    send->del(send);
+    uint8_t sent_le[2] = {0, 0};
+    esp32_spi_param_t send[] = {{1, &socket_num}, {len, buffer}};
+    esp32_spi_param_t resp[] = {{2, sent_le}};
 
-    if (resp == NULL)
+    if (esp32_spi_send_command_get_response_into(SEND_DATA_TCP_CMD, send, ARRAY_SIZE(send), resp, ARRAY_SIZE(resp), 1, 0) < 0)
     {
 #if ESP32_SPI_DEBUG
         printk("%s: get resp error!\r\n", __func__);
 #endif
-        return 0;
+        return -1;
     }
-    uint16_t sent = ( ((uint16_t)(resp->params[0]->param[1]) << 8) & 0xff00 ) | (uint16_t)(resp->params[0]->param[0]);
-    // if (sent != len) //TODO: the firmware is nonblock, so return value maybe < len
-    if (sent == 0)
-    {
+    uint16_t sent = ( ((uint16_t)(sent_le[1]) << 8) & 0xff00 ) | (uint16_t)(sent_le[0]);
+    // the firmware is nonblock, the caller resends whatever is left
 #if ESP32_SPI_DEBUG
-        printk("Failed to send %d bytes (sent %d)", len, sent);
+    if (sent != len)
+        printk("%s: sent %d of %d bytes\r\n", __func__, sent, len);
 #endif
-        resp->del(resp);
-        return 0;
-    }
 
 //     resp->del(resp);
 
-//     send = esp32_spi_params_alloc_1param(1, &socket_num);
-//     resp = esp32_spi_send_command_get_response(DATA_SENT_TCP_CMD, send, NULL, 0, 0);
-//     send->del(send);
+//     esp32_spi_param_t sent_send[] = {{1, &socket_num}};
+//     resp = esp32_spi_send_command_get_response(DATA_SENT_TCP_CMD, sent_send, ARRAY_SIZE(sent_send), NULL, 0, 0);
 
 //     if (resp == NULL)
 //     {
@@ -1390,16 +2128,15 @@ uint32_t esp32_spi_socket_write(uint8_t socket_num, uint8_t *buffer, uint16_t le
 //         return 0;
 //     }
 
-    resp->del(resp);
     return sent;
 }
 int8_t esp32_spi_add_udp_data(uint8_t socket_num, uint8_t* data, uint16_t data_len)
 {
-    esp32_spi_params_t *send = esp32_spi_params_alloc_2param(1, &socket_num, data_len, data );
-    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(ADD_UDP_DATA_CMD, send, NULL, 1, 0);
-    send->del(send);
+    uint8_t ok = 0;
+    esp32_spi_param_t send[] = {{1, &socket_num}, {data_len, data}};
+    esp32_spi_param_t resp[] = {{1, &ok}};
 
-    if (resp == NULL)
+    if (esp32_spi_send_command_get_response_into(ADD_UDP_DATA_CMD, send, ARRAY_SIZE(send), resp, ARRAY_SIZE(resp), 1, 0) < 0)
     {
 #if ESP32_SPI_DEBUG
         printk("Failed  get response\r\n");
@@ -1407,28 +2144,24 @@ int8_t esp32_spi_add_udp_data(uint8_t socket_num, uint8_t* data, uint16_t data_l
         return -2;
     }
 
-    uint8_t ok = resp->params[0]->param[0];
-
     if (ok != 1)
     {
 #if ESP32_SPI_DEBUG
         printk("Failed to sendto\r\n");
 #endif
-        resp->del(resp);
         return -1;
     }
 
-    resp->del(resp);
     return 0;
 }
 
 int8_t esp32_spi_send_udp_data(uint8_t socket_num)
 {
-    esp32_spi_params_t *send = esp32_spi_params_alloc_1param(1, &socket_num);
-    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(SEND_UDP_DATA_CMD, send, NULL, 0, 0);
-    send->del(send);
+    uint8_t ok = 0;
+    esp32_spi_param_t send[] = {{1, &socket_num}};
+    esp32_spi_param_t resp[] = {{1, &ok}};
 
-    if (resp == NULL)
+    if (esp32_spi_send_command_get_response_into(SEND_UDP_DATA_CMD, send, ARRAY_SIZE(send), resp, ARRAY_SIZE(resp), 0, 0) < 0)
     {
 #if ESP32_SPI_DEBUG
         printk("Failed  get response\r\n");
@@ -1436,29 +2169,25 @@ int8_t esp32_spi_send_udp_data(uint8_t socket_num)
         return -2;
     }
 
-    uint8_t ok = resp->params[0]->param[0];
-
     if (ok != 1)
     {
 #if ESP32_SPI_DEBUG
         printk("Failed to send udp data\r\n");
 #endif
-        resp->del(resp);
         return -1;
     }
 
-    resp->del(resp);
     return 0;
 }
 
 //Determine how many bytes are waiting to be read on the socket
 int esp32_spi_socket_available(uint8_t socket_num)
 {
-    esp32_spi_params_t *send = esp32_spi_params_alloc_1param(1, &socket_num);
-    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(AVAIL_DATA_TCP_CMD, send, NULL, 0, 0);
-    send->del(send);
+    uint8_t avail_le[2] = {0, 0};
+    esp32_spi_param_t send[] = {{1, &socket_num}};
+    esp32_spi_param_t resp[] = {{2, avail_le}};
 
-    if (resp == NULL)
+    if (esp32_spi_send_command_get_response_into(AVAIL_DATA_TCP_CMD, send, ARRAY_SIZE(send), resp, ARRAY_SIZE(resp), 0, 0) < 0)
     {
 #if ESP32_SPI_DEBUG
         printk("%s: get resp error!\r\n", __func__);
@@ -1468,18 +2197,18 @@ int esp32_spi_socket_available(uint8_t socket_num)
 
     int reply = 0;
 
-    reply = (int)((uint16_t)(resp->params[0]->param[1] << 8) | (uint16_t)(resp->params[0]->param[0]));
+    reply = (int)((uint16_t)(avail_le[1] << 8) | (uint16_t)(avail_le[0]));
 
 #if ESP32_SPI_DEBUG
     if(reply > 0)
         printk("ESPSocket: %d bytes available\r\n", reply);
 #endif
 
-    resp->del(resp);
     return reply;
 }
 
-//Read up to 'size' bytes from the socket number. Returns a bytearray
+// reads up to size bytes, returns how many the firmware had ready (0 if none),
+// or -1 if the command failed
 int esp32_spi_socket_read(uint8_t socket_num, uint8_t *buff, uint16_t size)
 {
 #if ESP32_SPI_DEBUG
@@ -1495,11 +2224,11 @@ int esp32_spi_socket_read(uint8_t socket_num, uint8_t *buff, uint16_t size)
     printk("len_0:%02x\tlen_1:%02x\r\n", len[0], len[1]);
 #endif
 
-    esp32_spi_params_t *send = esp32_spi_params_alloc_2param(1, &socket_num, 2, len);
-    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(GET_DATABUF_TCP_CMD, send, NULL, 1, 1);
-    send->del(send);
+    // the payload is clocked straight into the caller's buffer
+    esp32_spi_param_t send[] = {{1, &socket_num}, {2, len}};
+    esp32_spi_param_t resp[] = {{size, buff}};
 
-    if (resp == NULL)
+    if (esp32_spi_send_command_get_response_into(GET_DATABUF_TCP_CMD, send, ARRAY_SIZE(send), resp, ARRAY_SIZE(resp), 1, 1) < 0)
     {
 #if ESP32_SPI_DEBUG
         printk("%s: get resp error!\r\n", __func__);
@@ -1507,45 +2236,24 @@ int esp32_spi_socket_read(uint8_t socket_num, uint8_t *buff, uint16_t size)
         return -1;
     }
 
-#if 0
-    if (resp->params[0]->param_len != size)
-    {
-#if ESP32_SPI_DEBUG
-        printk("read error len\r\n");
-#endif
-        resp->del(resp);
-        return -1;
-    }
-#endif
-
-    uint16_t real_read_size = resp->params[0]->param_len;
-
-    if (real_read_size != 0)
-        memcpy(buff, resp->params[0]->param, real_read_size);
-    resp->del(resp);
-
-    return real_read_size;
+    return resp[0].param_len;
 }
 
 int8_t esp32_spi_get_remote_info(uint8_t socket_num, uint8_t* ip, uint16_t* port)
 {
-    uint32_t recv_num = 2;
-    esp32_spi_params_t *send = esp32_spi_params_alloc_1param(1, &socket_num);
-    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(GET_REMOTE_INFO_CMD, send, &recv_num, 0, 0);
-    send->del(send);
+    uint8_t port_be[2];
+    esp32_spi_param_t send[] = {{1, &socket_num}};
+    esp32_spi_param_t resp[] = {{4, ip}, {2, port_be}};
 
-    if (resp == NULL)
+    if (esp32_spi_send_command_get_response_into(GET_REMOTE_INFO_CMD, send, ARRAY_SIZE(send), resp, ARRAY_SIZE(resp), 0, 0) < 0)
     {
         return -1;
     }
-    if(resp->params_num!=2 || resp->params[0]->param_len != 4 || resp->params[1]->param_len != 2)
+    if(resp[0].param_len != 4 || resp[1].param_len != 2)
     {
-        resp->del(resp);
         return -1;
     }
-    memcpy(ip, resp->params[0]->param, 4);
-    *port = ( ((uint16_t)resp->params[1]->param[0])<<8 | resp->params[1]->param[1]);
-    resp->del(resp);
+    *port = ( ((uint16_t)port_be[0])<<8 | port_be[1]);
     return 0;
 }
 
@@ -1579,28 +2287,38 @@ int8_t esp32_spi_socket_connect(uint8_t socket_num, uint8_t *dest, uint8_t dest_
 
     while ((sysctl_get_time_us() - tm) < 3 * 1000 * 1000) //3s
     {
-        uint8_t ret = esp32_spi_socket_status(socket_num);
-        if (ret == SOCKET_ESTABLISHED)
-            return 0;
-        else if(ret == 0xff) // EIO
-        {
-            return -2;
-        }
-        // msleep(100);
+        ret = esp32_spi_socket_connect_poll(socket_num);
+        if (ret <= 0)
+            return ret;
+        msleep(ESP32_SPI_CONNECT_POLL_MS);
     }
     return -3;
 }
 
+// Check on a connection started with esp32_spi_socket_open
+//-2 error
+//0 established
+//1 still connecting
+int8_t esp32_spi_socket_connect_poll(uint8_t socket_num)
+{
+    uint8_t ret = esp32_spi_socket_status(socket_num);
+    if (ret == SOCKET_ESTABLISHED)
+        return 0;
+    else if(ret == 0xff) // EIO
+        return -2;
+    return 1;
+}
+
 // Close a socket using the ESP32's internal reference number
 //-1 error
 //0 ok
 int8_t esp32_spi_socket_close(uint8_t socket_num)
 {
-    esp32_spi_params_t *send = esp32_spi_params_alloc_1param(1, &socket_num);
-    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(STOP_CLIENT_TCP_CMD, send, NULL, 0, 0);
-    send->del(send);
+    uint8_t ok = 0;
+    esp32_spi_param_t send[] = {{1, &socket_num}};
+    esp32_spi_param_t resp[] = {{1, &ok}};
 
-    if (resp == NULL)
+    if (esp32_spi_send_command_get_response_into(STOP_CLIENT_TCP_CMD, send, ARRAY_SIZE(send), resp, ARRAY_SIZE(resp), 0, 0) < 0)
     {
 #if ESP32_SPI_DEBUG
         printk("%s: get resp error!\r\n", __func__);
@@ -1608,16 +2326,15 @@ int8_t esp32_spi_socket_close(uint8_t socket_num)
         return -1;
     }
 
-    if (resp->params[0]->param[0] != 1)
+    if (ok != 1)
     {
 
 #if ESP32_SPI_DEBUG
         printk("Failed to close socket\r\n");
 #endif
-        resp->del(resp);
         return -1;
     }
-    resp->del(resp);
+
     return 0;
 }
 
@@ -1634,9 +2351,8 @@ int8_t esp32_spi_get_adc_val(uint8_t* channels, uint8_t len, uint16_t *val)
     }
 
     uint32_t num = len;
-    esp32_spi_params_t *send = esp32_spi_params_alloc_1param(len, channels);
-    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(GET_ADC_VAL_CMD, send, &num, 0, 0);
-    send->del(send);
+    esp32_spi_param_t send[] = {{len, channels}};
+    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(GET_ADC_VAL_CMD, send, ARRAY_SIZE(send), &num, 0, 0);
 
     if (resp == NULL)
     {
@@ -1753,67 +2469,18 @@ int8_t esp32_spi_start_server(uint8_t sock_num, uint8_t *dest, uint8_t dest_type
     printk("port: 0x%02x 0x%02x\r\n", port_arr[0], port_arr[1]);
 #endif
 
-    esp32_spi_params_t *send = (esp32_spi_params_t *)malloc(sizeof(esp32_spi_params_t));
-    send->del = delete_esp32_spi_params;
+    uint8_t mode = (uint8_t)conn_mode;
 
-    uint32_t param_len = 0;
+    esp32_spi_param_t send[4];
+    uint32_t send_num = 0;
 
     if (dest_type)
-    {
-        send->params_num = 4;
-        send->params = (void *)malloc(sizeof(void *) * send->params_num);
-        //
-        param_len = 4;
-        send->params[0] = (esp32_spi_param_t *)malloc(sizeof(esp32_spi_param_t));
-        send->params[0]->param_len = param_len;
-        send->params[0]->param = (uint8_t *)malloc(sizeof(uint8_t) * param_len);
-        memcpy(send->params[0]->param, dest, param_len);
-        //
-        param_len = 2;
-        send->params[1] = (esp32_spi_param_t *)malloc(sizeof(esp32_spi_param_t));
-        send->params[1]->param_len = param_len;
-        send->params[1]->param = (uint8_t *)malloc(sizeof(uint8_t) * param_len);
-        memcpy(send->params[1]->param, port_arr, param_len);
-        //
-        param_len = 1;
-        send->params[2] = (esp32_spi_param_t *)malloc(sizeof(esp32_spi_param_t));
-        send->params[2]->param_len = param_len;
-        send->params[2]->param = (uint8_t *)malloc(sizeof(uint8_t) * param_len);
-        send->params[2]->param[0] = sock_num;
-        //
-        param_len = 1;
-        send->params[3] = (esp32_spi_param_t *)malloc(sizeof(esp32_spi_param_t));
-        send->params[3]->param_len = param_len;
-        send->params[3]->param = (uint8_t *)malloc(sizeof(uint8_t) * param_len);
-        send->params[3]->param[0] = conn_mode;
-    }
-    else
-    {
-        send->params_num = 3;
-        send->params = (void *)malloc(sizeof(void *) * send->params_num);
-        //
-        param_len = 2;
-        send->params[0] = (esp32_spi_param_t *)malloc(sizeof(esp32_spi_param_t));
-        send->params[0]->param_len = param_len;
-        send->params[0]->param = (uint8_t *)malloc(sizeof(uint8_t) * param_len);
-        memcpy(send->params[0]->param, port_arr, param_len);
-        //
-        param_len = 1;
-        send->params[1] = (esp32_spi_param_t *)malloc(sizeof(esp32_spi_param_t));
-        send->params[1]->param_len = param_len;
-        send->params[1]->param = (uint8_t *)malloc(sizeof(uint8_t) * param_len);
-        send->params[1]->param[0] = sock_num;
-        //
-        param_len = 1;
-        send->params[2] = (esp32_spi_param_t *)malloc(sizeof(esp32_spi_param_t));
-        send->params[2]->param_len = param_len;
-        send->params[2]->param = (uint8_t *)malloc(sizeof(uint8_t) * param_len);
-        send->params[2]->param[0] = conn_mode;
-    }
-
-    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(START_SERVER_TCP_CMD, send, NULL, 0, 0);
-
-    send->del(send);
+        send[send_num++] = (esp32_spi_param_t){4, dest};
+    send[send_num++] = (esp32_spi_param_t){2, port_arr};
+    send[send_num++] = (esp32_spi_param_t){1, &sock_num};
+    send[send_num++] = (esp32_spi_param_t){1, &mode};
+
+    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(START_SERVER_TCP_CMD, send, send_num, NULL, 0, 0);
 
     if (resp == NULL)
     {
@@ -1838,11 +2505,11 @@ int8_t esp32_spi_start_server(uint8_t sock_num, uint8_t *dest, uint8_t dest_type
 
 int8_t esp32_spi_server_status(uint8_t socket_num)
 {
-    esp32_spi_params_t *send = esp32_spi_params_alloc_1param(1, &socket_num);
-    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(GET_STATE_TCP_CMD, send, NULL, 0, 0);
-    send->del(send);
+    uint8_t stat = 0;
+    esp32_spi_param_t send[] = {{1, &socket_num}};
+    esp32_spi_param_t resp[] = {{1, &stat}};
 
-    if (resp == NULL)
+    if (esp32_spi_send_command_get_response_into(GET_STATE_TCP_CMD, send, ARRAY_SIZE(send), resp, ARRAY_SIZE(resp), 0, 0) < 0)
     {
 #if ESP32_SPI_DEBUG
         printk("%s: get resp error!\r\n", __func__);
@@ -1851,9 +2518,7 @@ int8_t esp32_spi_server_status(uint8_t socket_num)
     }
     int8_t ret;
 
-    ret = (int8_t)resp->params[0]->param[0];
-
-    resp->del(resp);
+    ret = (int8_t)stat;
 
 #if (ESP32_SPI_DEBUG > 1)
     printk("sock stat :%d\r\n", ret);
@@ -1863,12 +2528,12 @@ int8_t esp32_spi_server_status(uint8_t socket_num)
 
 int esp32_spi_get_data(uint8_t socket_num)
 {
-    esp32_spi_params_t *send = esp32_spi_params_alloc_2param(1, &socket_num, 1, 0);
-//    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(GET_DATA_TCP_CMD, send, NULL, 1, 1);
-    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(GET_DATA_TCP_CMD, send, NULL, 0, 0);
-    send->del(send);
+    uint8_t peek = 0;
+    uint8_t data = 0;
+    esp32_spi_param_t send[] = {{1, &socket_num}, {1, &peek}};
+    esp32_spi_param_t resp[] = {{1, &data}};
 
-    if (resp == NULL)
+    if (esp32_spi_send_command_get_response_into(GET_DATA_TCP_CMD, send, ARRAY_SIZE(send), resp, ARRAY_SIZE(resp), 0, 0) < 0)
     {
 #if ESP32_SPI_DEBUG
         printk("%s: get resp error!\r\n", __func__);
@@ -1876,31 +2541,17 @@ int esp32_spi_get_data(uint8_t socket_num)
         return -1;
     }
 
-#if 0
-    if (resp->params[0]->param_len != size)
-    {
-#if ESP32_SPI_DEBUG
-        printk("read error len\r\n");
-#endif
-        resp->del(resp);
-        return -1;
-    }
-#endif
-
     int8_t ret;
 
-    ret = (int8_t)resp->params[0]->param[0];
-
-    resp->del(resp);
+    ret = (int8_t)data;
 
     return ret;
 }
 
 int8_t esp32_spi_ap_net(uint8_t *ssid, uint8_t channel)
 {
-    esp32_spi_params_t *send = esp32_spi_params_alloc_2param(strlen((const char*)ssid), ssid, 1, &channel);
-    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(SET_AP_NET_CMD, send, NULL, 0, 0);
-    send->del(send);
+    esp32_spi_param_t send[] = {{strlen((const char*)ssid), ssid}, {1, &channel}};
+    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(SET_AP_NET_CMD, send, ARRAY_SIZE(send), NULL, 0, 0);
 
     if (resp == NULL)
     {
@@ -1925,35 +2576,8 @@ int8_t esp32_spi_ap_net(uint8_t *ssid, uint8_t channel)
 
 int8_t esp32_spi_ap_pass_phrase(uint8_t *ssid, uint8_t *pwd, uint8_t channel)
 {
-    esp32_spi_params_t *send = (esp32_spi_params_t *)malloc(sizeof(esp32_spi_params_t));
-    send->del = delete_esp32_spi_params;
-
-    uint32_t param_len = 0;
-
-    send->params_num = 3;
-    send->params = (void *)malloc(sizeof(void *) * send->params_num);
-    //
-    param_len = strlen((const char*)ssid);
-    send->params[0] = (esp32_spi_param_t *)malloc(sizeof(esp32_spi_param_t));
-    send->params[0]->param_len = param_len;
-    send->params[0]->param = (uint8_t *)malloc(sizeof(uint8_t) * param_len);
-    memcpy(send->params[0]->param, ssid, param_len);
-    //
-    param_len = strlen((const char*)pwd);
-    send->params[1] = (esp32_spi_param_t *)malloc(sizeof(esp32_spi_param_t));
-    send->params[1]->param_len = param_len;
-    send->params[1]->param = (uint8_t *)malloc(sizeof(uint8_t) * param_len);
-    memcpy(send->params[1]->param, pwd, param_len);
-    //
-    param_len = 1;
-    send->params[2] = (esp32_spi_param_t *)malloc(sizeof(esp32_spi_param_t));
-    send->params[2]->param_len = param_len;
-    send->params[2]->param = (uint8_t *)malloc(sizeof(uint8_t) * param_len);
-    send->params[2]->param[0] = channel;
-
-    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(SET_AP_NET_CMD, send, NULL, 0, 0);
-
-    send->del(send);
+    esp32_spi_param_t send[] = {{strlen((const char*)ssid), ssid}, {strlen((const char*)pwd), pwd}, {1, &channel}};
+    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(SET_AP_NET_CMD, send, ARRAY_SIZE(send), NULL, 0, 0);
 
     if (resp == NULL)
     {
@@ -1987,9 +2611,8 @@ uint8_t *esp32_spi_get_bssid(void)
 
     uint8_t data = 0xff;
 
-    esp32_spi_params_t *send = esp32_spi_params_alloc_1param(1, &data);
-    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(GET_CURR_BSSID_CMD, send, NULL, 0, 0);
-    send->del(send);
+    esp32_spi_param_t send[] = {{1, &data}};
+    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(GET_CURR_BSSID_CMD, send, ARRAY_SIZE(send), NULL, 0, 0);
 
     if (resp == NULL)
     {
@@ -2010,9 +2633,8 @@ uint32_t esp32_spi_get_time(void)
 {
     uint8_t data = 0xff;
 
-    esp32_spi_params_t *send = esp32_spi_params_alloc_1param(1, &data);
-    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(GET_TIME_CMD, send, NULL, 0, 0);
-    send->del(send);
+    esp32_spi_param_t send[] = {{1, &data}};
+    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(GET_TIME_CMD, send, ARRAY_SIZE(send), NULL, 0, 0);
 
     if (resp == NULL)
     {
@@ -2031,9 +2653,8 @@ uint32_t esp32_spi_get_time(void)
 
 void esp32_set_certificate(char *client_ca)
 {
-    esp32_spi_params_t *send = esp32_spi_params_alloc_1param(strlen((const char*)client_ca), (uint8_t *)client_ca);
-    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(SET_CLIENT_CERT_CMD, send, NULL, 1, 0);
-    send->del(send);
+    esp32_spi_param_t send[] = {{strlen((const char*)client_ca), (uint8_t *)client_ca}};
+    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(SET_CLIENT_CERT_CMD, send, ARRAY_SIZE(send), NULL, 1, 0);
 
     if (resp == NULL)
     {
@@ -2046,9 +2667,8 @@ void esp32_set_certificate(char *client_ca)
 
 void esp32_set_private_key(char *private_key)
 {
-    esp32_spi_params_t *send = esp32_spi_params_alloc_1param(strlen((const char*)private_key), (uint8_t *)private_key);
-    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(SET_CERT_KEY_CMD, send, NULL, 1, 0);
-    send->del(send);
+    esp32_spi_param_t send[] = {{strlen((const char*)private_key), (uint8_t *)private_key}};
+    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(SET_CERT_KEY_CMD, send, ARRAY_SIZE(send), NULL, 1, 0);
 
     if (resp == NULL)
     {
@@ -2061,9 +2681,8 @@ void esp32_set_private_key(char *private_key)
 
 void esp32_set_debug(uint8_t debug)
 {
-    esp32_spi_params_t *send = esp32_spi_params_alloc_1param(1, &debug);
-    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(SET_DEBUG_CMD, send, NULL, 0, 0);
-    send->del(send);
+    esp32_spi_param_t send[] = {{1, &debug}};
+    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(SET_DEBUG_CMD, send, ARRAY_SIZE(send), NULL, 0, 0);
 
     if (resp == NULL)
     {
@@ -2078,9 +2697,8 @@ float esp32_spi_get_temperature(void)
 {
     uint8_t data = 0xff;
 
-    esp32_spi_params_t *send = esp32_spi_params_alloc_1param(1, &data);
-    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(GET_TIME_CMD, send, NULL, 0, 0);
-    send->del(send);
+    esp32_spi_param_t send[] = {{1, &data}};
+    esp32_spi_params_t *resp = esp32_spi_send_command_get_response(GET_TIME_CMD, send, ARRAY_SIZE(send), NULL, 0, 0);
 
     if (resp == NULL)
     {
@@ -2097,3 +2715,79 @@ float esp32_spi_get_temperature(void)
     return temperature;
 }
 
+
+//Current hard SPI clock step in Hz
+uint32_t esp32_spi_get_clock(void)
+{
+    return clk_steps[clk_step];
+}
+
+//One training round trip: the firmware version read into a fixed buffer,
+//the reply must have exactly one param so a garbled count cannot allocate
+//-1 error
+//other length of the version string
+static int32_t esp32_spi_train_probe(uint8_t *buf, uint32_t size)
+{
+    esp32_spi_param_t resp[] = {{size, buf}};
+
+    if (esp32_spi_send_command_get_response_into(GET_FW_VERSION_CMD, NULL, 0, resp, ARRAY_SIZE(resp), 0, 0) < 0)
+        return -1;
+    return resp[0].param_len;
+}
+
+//Step the hard SPI clock up from the slowest rate, checking every step with
+//ESP32_SPI_TRAIN_ROUNDS firmware version queries against a reference read at
+//the slowest rate, and settle on the fastest step that never failed
+//returns the trained clock in Hz, 0 for soft SPI or no answer
+uint32_t esp32_spi_train_clock(uint32_t max_rate)
+{
+    uint8_t ref[32], got[32];
+    int32_t ref_len, got_len;
+
+    if (!is_hard_spi)
+        return 0;
+
+    clk_training = 1;
+    clk_step = 0;
+    hard_spi_set_clk_rate(clk_steps[clk_step]);
+
+    ref_len = esp32_spi_train_probe(ref, sizeof(ref));
+    if (ref_len < 0)
+    {
+        clk_step = CLK_STEP_DEFAULT;
+        clk_ceiling = clk_step;
+        hard_spi_set_clk_rate(clk_steps[clk_step]);
+        clk_training = 0;
+        return 0;
+    }
+
+    uint8_t best = 0;
+    for (uint8_t i = 1; i < ARRAY_SIZE(clk_steps) && clk_steps[i] <= max_rate; i++)
+    {
+        hard_spi_set_clk_rate(clk_steps[i]);
+
+        uint8_t ok = 1;
+        for (uint8_t j = 0; j < ESP32_SPI_TRAIN_ROUNDS && ok; j++)
+        {
+            got_len = esp32_spi_train_probe(got, sizeof(got));
+            if (got_len != ref_len || memcmp(ref, got, ref_len) != 0)
+                ok = 0;
+        }
+        if (!ok)
+            break;
+        best = i;
+    }
+
+    clk_step = best;
+    clk_ceiling = best;
+    hard_spi_set_clk_rate(clk_steps[clk_step]);
+    link_errors = 0;
+    link_clean = 0;
+    clk_training = 0;
+
+#if ESP32_SPI_DEBUG
+    printk("spi clk trained to %d\r\n", clk_steps[clk_step]);
+#endif
+
+    return clk_steps[clk_step];
+}
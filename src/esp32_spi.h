@@ -11,8 +11,94 @@ extern "C" {
 #define ESP32_SPI_DEBUG                 (0)
 
 #define ESP32_ADC_CH_NUM                (6)
+
+// with ESP32_SPI_RDY_WFI, take a GPIOHS interrupt on ready-pin edges to wake sleeping waiters;
+// without WFI no interrupt is registered
+#ifndef ESP32_SPI_RDY_IRQ
+#define ESP32_SPI_RDY_IRQ               (1)
+#endif
+// busy-poll the ready pin this long before sleeping until the edge interrupt (ESP32_SPI_RDY_WFI)
+#ifndef ESP32_SPI_RDY_SPIN_US
+#define ESP32_SPI_RDY_SPIN_US           (100)
+#endif
+// sleep with wfi while waiting, needs the PLIC and machine interrupts enabled;
+// 0 busy-polls the pin
+#ifndef ESP32_SPI_RDY_WFI
+#define ESP32_SPI_RDY_WFI               (0)
+#endif
 #define SPI_MAX_DMA_LEN 4000 //(4096-4)
 
+// capacity of a scan result array
+#ifndef WL_NETWORKS_LIST_MAXNUM
+#define WL_NETWORKS_LIST_MAXNUM 10
+#endif
+
+// optional scan entry fields, each costs one more round trip per entry
+#define ESP32_SPI_SCAN_BSSID            (0x01)
+#define ESP32_SPI_SCAN_CHANNEL          (0x02)
+
+// hard SPI clock the link starts at, before any training
+#define ESP32_SPI_CLK_DEFAULT           (1000000 * 9)
+// consecutive framing errors before the hard SPI clock steps down
+#ifndef ESP32_SPI_LINK_ERR_MAX
+#define ESP32_SPI_LINK_ERR_MAX          (3)
+#endif
+// clean replies in a row before a backed-off clock steps up again, towards
+// the trained (or default) clock but never past it
+#ifndef ESP32_SPI_LINK_OK_MIN
+#define ESP32_SPI_LINK_OK_MIN           (256)
+#endif
+// GET_FW_VERSION_CMD round trips that must all pass for a clock step to be kept
+#ifndef ESP32_SPI_TRAIN_ROUNDS
+#define ESP32_SPI_TRAIN_ROUNDS          (8)
+#endif
+// pause between socket status checks while a connection is being set up
+#ifndef ESP32_SPI_CONNECT_POLL_MS
+#define ESP32_SPI_CONNECT_POLL_MS       (10)
+#endif
+// status poll interval while joining an access point
+#ifndef ESP32_SPI_CONNECT_AP_POLL_MS
+#define ESP32_SPI_CONNECT_AP_POLL_MS    (100)
+#endif
+// how long the reset line is held low
+#ifndef ESP32_SPI_RESET_PULSE_MS
+#define ESP32_SPI_RESET_PULSE_MS        (10)
+#endif
+// without a reset line, time for the firmware to act on SOFT_RESET_CMD before probing
+#ifndef ESP32_SPI_SOFT_RESET_SETTLE_MS
+#define ESP32_SPI_SOFT_RESET_SETTLE_MS  (100)
+#endif
+// minimum spacing of boot probes, and the most one probe may wait for the ready pin
+#ifndef ESP32_SPI_BOOT_PROBE_MS
+#define ESP32_SPI_BOOT_PROBE_MS         (10)
+#endif
+#ifndef ESP32_SPI_BOOT_PROBE_TIMEOUT_MS
+#define ESP32_SPI_BOOT_PROBE_TIMEOUT_MS (20)
+#endif
+// give up on a firmware that has not answered this long after reset
+#ifndef ESP32_SPI_BOOT_TIMEOUT_MS
+#define ESP32_SPI_BOOT_TIMEOUT_MS       (3000)
+#endif
+// longest DHCP host name esp32_spi_set_hostname accepts
+#ifndef ESP32_SPI_HOSTNAME_MAX
+#define ESP32_SPI_HOSTNAME_MAX          (32)
+#endif
+// host name cache used by esp32_spi_get_host_by_name
+#ifndef ESP32_SPI_DNS_CACHE_SIZE
+#define ESP32_SPI_DNS_CACHE_SIZE        (4)
+#endif
+// longer names are resolved every time
+#ifndef ESP32_SPI_DNS_NAME_MAX
+#define ESP32_SPI_DNS_NAME_MAX          (64)
+#endif
+// seconds a resolved / failed name stays cached, 0 disables
+#ifndef ESP32_SPI_DNS_TTL_S
+#define ESP32_SPI_DNS_TTL_S             (300)
+#endif
+#ifndef ESP32_SPI_DNS_NEG_TTL_S
+#define ESP32_SPI_DNS_NEG_TTL_S         (10)
+#endif
+
 #if 1
 #define _DEBUG()
 #else
@@ -157,6 +243,8 @@ typedef struct
     int8_t rssi;
     uint8_t encr;
     uint8_t ssid[33];
+    uint8_t bssid[6];
+    uint8_t channel;
 } esp32_spi_ap_t;
 
 typedef struct
@@ -174,12 +262,20 @@ typedef struct
 } esp32_spi_net_t;
 
 void esp32_spi_init(uint8_t cs_num, uint8_t rst_num, uint8_t rdy_num, uint8_t is_hard_spi);
+void esp32_spi_init_start(uint8_t cs_num, uint8_t rst_num, uint8_t rdy_num, uint8_t is_hard_spi);
+void esp32_spi_boot_start(void);
+int8_t esp32_spi_boot_poll(void);
 int8_t esp32_spi_status(void);
 char *esp32_spi_firmware_version(char* fw_version);
 uint8_t *esp32_spi_MAC_address(void);
 
 int8_t esp32_spi_start_scan_networks(void);
 esp32_spi_aps_list_t *esp32_spi_get_scan_networks(void);
+int32_t esp32_spi_get_scan_results(esp32_spi_ap_t *aps, uint32_t max, uint8_t flags);
+int8_t esp32_spi_get_scan_extras(uint8_t idx, esp32_spi_ap_t *ap, uint8_t flags);
+int8_t esp32_spi_scan_async_start(esp32_spi_ap_t *aps, uint32_t max, uint8_t flags);
+int32_t esp32_spi_scan_async_poll(uint8_t *done);
+void esp32_spi_scan_async_cancel(void);
 esp32_spi_aps_list_t *esp32_spi_scan_networks(void);
 int8_t esp32_spi_wifi_set_network(uint8_t *ssid);
 int8_t esp32_spi_wifi_wifi_set_passphrase(uint8_t *ssid, uint8_t *passphrase);
@@ -187,26 +283,38 @@ char *esp32_spi_get_ssid(void);
 int8_t esp32_spi_get_rssi(void);
 esp32_spi_net_t *esp32_spi_get_network_data(void);
 int8_t esp32_spi_ip_address(uint8_t *net_data);
+int8_t esp32_spi_set_ip_config(uint8_t valid_params, uint8_t *ip, uint8_t *gateway, uint8_t *subnet);
+int8_t esp32_spi_set_dns_config(uint8_t valid_params, uint8_t *dns1, uint8_t *dns2);
+int8_t esp32_spi_set_hostname(uint8_t *hostname);
 uint8_t esp32_spi_is_connected(void);
 void esp32_spi_connect(uint8_t *secrets);
+int8_t esp32_spi_connect_AP_start(uint8_t *ssid, uint8_t *password);
 int8_t esp32_spi_connect_AP(uint8_t *ssid, uint8_t *password, uint8_t retry_times);
 int8_t esp32_spi_disconnect_from_AP(void);
 void esp32_spi_pretty_ip(uint8_t *ip, uint8_t *str_ip);
 int esp32_spi_get_host_by_name(uint8_t *hostname, uint8_t *ip);
+void esp32_spi_dns_cache_config(uint32_t ttl_s, uint32_t neg_ttl_s);
+void esp32_spi_dns_cache_flush(void);
+int esp32_spi_resolve_start(uint8_t *hostname);
+int esp32_spi_resolve_poll(uint8_t *ip);
 int32_t esp32_spi_ping(uint8_t *dest, uint8_t dest_type, uint8_t ttl);
 
 uint8_t esp32_spi_get_socket(void);
 int8_t esp32_spi_socket_open(uint8_t sock_num, uint8_t *dest, uint8_t dest_type, uint16_t port, esp32_socket_mode_enum_t conn_mode);
 esp32_socket_enum_t esp32_spi_socket_status(uint8_t socket_num);
 uint8_t esp32_spi_socket_connected(uint8_t socket_num);
-uint32_t esp32_spi_socket_write(uint8_t socket_num, uint8_t *buffer, uint16_t len);
+int32_t esp32_spi_socket_write(uint8_t socket_num, uint8_t *buffer, uint16_t len);
 int esp32_spi_socket_available(uint8_t socket_num);
 int esp32_spi_socket_read(uint8_t socket_num, uint8_t *buff, uint16_t size);
+int8_t esp32_spi_socket_connect_poll(uint8_t socket_num);
 int8_t esp32_spi_socket_connect(uint8_t socket_num, uint8_t *dest, uint8_t dest_type, uint16_t port, esp32_socket_mode_enum_t conn_mod);
 int8_t esp32_spi_socket_close(uint8_t socket_num);
 
 int8_t esp32_spi_get_adc_val(uint8_t* channels, uint8_t len, uint16_t *val);
 
+uint32_t esp32_spi_train_clock(uint32_t max_rate);
+uint32_t esp32_spi_get_clock(void);
+
 char *socket_enum_to_str(esp32_socket_enum_t x);
 char *wlan_enum_to_str(esp32_wlan_enum_t x);
 
@@ -7,23 +7,56 @@
 #include <utils.h>
 //#include "spi_.h"
 #include "../kendryte-standalone-sdk/lib/drivers/include/spi.h"
+#include "dmac.h"
 #include "esp32_spi.h"
 
 #include "fpioa.h"
 
-#define GPIOHS_OUT_HIGH(io) (*(volatile uint32_t *)0x3800100CU) |= (1 << (io))
-#define GPIOHS_OUT_LOWX(io) (*(volatile uint32_t *)0x3800100CU) &= ~(1 << (io))
-
-#define GET_GPIOHS_VALX(io) (((*(volatile uint32_t *)0x38001000U) >> (io)) & 1)
+#define GPIOHS_OUT_VAL (*(volatile uint32_t *)0x3800100CU)
+#define GPIOHS_IN_VAL (*(volatile uint32_t *)0x38001000U)
 
 static uint8_t _mosi_num = -1;
 static uint8_t _miso_num = -1;
 static uint8_t _sclk_num = -1;
 
+/* Pin masks for the bit-bang engine. Define ESP32_SPI_SOFT_MOSI_NUM,
+ * ESP32_SPI_SOFT_MISO_NUM and ESP32_SPI_SOFT_SCLK_NUM to fold them into
+ * immediates at build time; soft_spi_config_io then drives those pins
+ * whatever it is passed. Otherwise the masks are computed once in
+ * soft_spi_config_io. */
+#if defined(ESP32_SPI_SOFT_MOSI_NUM) && defined(ESP32_SPI_SOFT_MISO_NUM) && defined(ESP32_SPI_SOFT_SCLK_NUM)
+#define SOFT_MOSI_MASK (1U << ESP32_SPI_SOFT_MOSI_NUM)
+#define SOFT_SCLK_MASK (1U << ESP32_SPI_SOFT_SCLK_NUM)
+#define SOFT_MISO_SHIFT (ESP32_SPI_SOFT_MISO_NUM)
+#else
+static uint32_t _mosi_mask = 0;
+static uint32_t _sclk_mask = 0;
+#define SOFT_MOSI_MASK _mosi_mask
+#define SOFT_SCLK_MASK _sclk_mask
+#define SOFT_MISO_SHIFT _miso_num
+#endif
+
+// CPU cycles per half SCLK period, 0 runs unthrottled
+static uint32_t soft_spi_half_cycles = 0;
+
 /* SPI端口初始化 */
 //should check io value
 void soft_spi_config_io(uint8_t mosi, uint8_t miso, uint8_t sclk)
 {
+#if defined(ESP32_SPI_SOFT_MOSI_NUM) && defined(ESP32_SPI_SOFT_MISO_NUM) && defined(ESP32_SPI_SOFT_SCLK_NUM)
+    // the masks are fixed at build time, configure the pins they drive
+    if (mosi != ESP32_SPI_SOFT_MOSI_NUM || miso != ESP32_SPI_SOFT_MISO_NUM || sclk != ESP32_SPI_SOFT_SCLK_NUM)
+    {
+#if ESP32_SPI_DEBUG
+        printf("soft spi pins %d/%d/%d ignored, built for %d/%d/%d\r\n", mosi, miso, sclk,
+               ESP32_SPI_SOFT_MOSI_NUM, ESP32_SPI_SOFT_MISO_NUM, ESP32_SPI_SOFT_SCLK_NUM);
+#endif
+        mosi = ESP32_SPI_SOFT_MOSI_NUM;
+        miso = ESP32_SPI_SOFT_MISO_NUM;
+        sclk = ESP32_SPI_SOFT_SCLK_NUM;
+    }
+#endif
+
     //clk
     gpiohs_set_drive_mode(sclk, GPIO_DM_OUTPUT);
     gpiohs_set_pin(sclk, 0);
@@ -36,41 +69,111 @@ void soft_spi_config_io(uint8_t mosi, uint8_t miso, uint8_t sclk)
     _mosi_num = mosi;
     _miso_num = miso;
     _sclk_num = sclk;
+#if !(defined(ESP32_SPI_SOFT_MOSI_NUM) && defined(ESP32_SPI_SOFT_MISO_NUM) && defined(ESP32_SPI_SOFT_SCLK_NUM))
+    _mosi_mask = 1U << mosi;
+    _sclk_mask = 1U << sclk;
+#endif
 }
 
-uint8_t soft_spi_rw(uint8_t data)
+//Set the soft SPI clock, 0 for as fast as the GPIOHS allows
+//returns the rate the cycle counter can actually hit
+uint32_t soft_spi_set_clk_rate(uint32_t rate)
 {
-    uint8_t i;
-    uint8_t temp = 0;
-    for (i = 0; i < 8; i++)
+    uint32_t cpu = sysctl_clock_get_freq(SYSCTL_CLOCK_CPU);
+
+    if (rate == 0)
     {
-        if (data & 0x80)
-        {
-            GPIOHS_OUT_HIGH(_mosi_num);
-        }
-        else
-        {
-            GPIOHS_OUT_LOWX(_mosi_num);
-        }
-        data <<= 1;
-        GPIOHS_OUT_HIGH(_sclk_num);
+        soft_spi_half_cycles = 0;
+        return 0;
+    }
+    soft_spi_half_cycles = cpu / (2 * rate);
+    if (soft_spi_half_cycles == 0)
+        soft_spi_half_cycles = 1;
+    return cpu / (2 * soft_spi_half_cycles);
+}
 
+static inline void soft_spi_half_period(uint32_t half)
+{
+    if (half)
+    {
+        uint64_t t = read_cycle();
+        while (read_cycle() - t < half)
+            ;
+    }
+    else
+    {
         asm volatile("nop");
         asm volatile("nop");
         asm volatile("nop");
+    }
+}
 
-        temp <<= 1;
-        if (GET_GPIOHS_VALX(_miso_num))
-        {
-            temp++;
-        }
-        GPIOHS_OUT_LOWX(_sclk_num);
+/* One SCLK cycle, mode 0: set MOSI, rising edge, sample MISO, falling edge.
+ * The _W variant skips the MISO sample, the _R variant leaves MOSI alone. */
+#define SOFT_SPI_BIT_RW(out, in, bit)                                    \
+    do                                                                   \
+    {                                                                    \
+        if ((out) & (0x80 >> (bit)))                                     \
+            GPIOHS_OUT_VAL |= mosi;                                      \
+        else                                                             \
+            GPIOHS_OUT_VAL &= ~mosi;                                     \
+        GPIOHS_OUT_VAL |= sclk;                                          \
+        soft_spi_half_period(half);                                      \
+        (in) = ((in) << 1) | ((GPIOHS_IN_VAL >> miso) & 1);              \
+        GPIOHS_OUT_VAL &= ~sclk;                                         \
+        soft_spi_half_period(half);                                      \
+    } while (0)
+
+#define SOFT_SPI_BIT_W(out, bit)                                         \
+    do                                                                   \
+    {                                                                    \
+        if ((out) & (0x80 >> (bit)))                                     \
+            GPIOHS_OUT_VAL |= mosi;                                      \
+        else                                                             \
+            GPIOHS_OUT_VAL &= ~mosi;                                     \
+        GPIOHS_OUT_VAL |= sclk;                                          \
+        soft_spi_half_period(half);                                      \
+        GPIOHS_OUT_VAL &= ~sclk;                                         \
+        soft_spi_half_period(half);                                      \
+    } while (0)
+
+#define SOFT_SPI_BIT_R(in)                                               \
+    do                                                                   \
+    {                                                                    \
+        GPIOHS_OUT_VAL |= sclk;                                          \
+        soft_spi_half_period(half);                                      \
+        (in) = ((in) << 1) | ((GPIOHS_IN_VAL >> miso) & 1);              \
+        GPIOHS_OUT_VAL &= ~sclk;                                         \
+        soft_spi_half_period(half);                                      \
+    } while (0)
+
+#define SOFT_SPI_BYTE_RW(out, in)                                                                           \
+    SOFT_SPI_BIT_RW(out, in, 0); SOFT_SPI_BIT_RW(out, in, 1); SOFT_SPI_BIT_RW(out, in, 2); SOFT_SPI_BIT_RW(out, in, 3); \
+    SOFT_SPI_BIT_RW(out, in, 4); SOFT_SPI_BIT_RW(out, in, 5); SOFT_SPI_BIT_RW(out, in, 6); SOFT_SPI_BIT_RW(out, in, 7)
+
+#define SOFT_SPI_BYTE_W(out)                                                                \
+    SOFT_SPI_BIT_W(out, 0); SOFT_SPI_BIT_W(out, 1); SOFT_SPI_BIT_W(out, 2); SOFT_SPI_BIT_W(out, 3); \
+    SOFT_SPI_BIT_W(out, 4); SOFT_SPI_BIT_W(out, 5); SOFT_SPI_BIT_W(out, 6); SOFT_SPI_BIT_W(out, 7)
+
+#define SOFT_SPI_BYTE_R(in)                                                         \
+    SOFT_SPI_BIT_R(in); SOFT_SPI_BIT_R(in); SOFT_SPI_BIT_R(in); SOFT_SPI_BIT_R(in); \
+    SOFT_SPI_BIT_R(in); SOFT_SPI_BIT_R(in); SOFT_SPI_BIT_R(in); SOFT_SPI_BIT_R(in)
+
+// pull the masks and timing into registers for the whole transfer
+#define SOFT_SPI_LOCALS                         \
+    const uint32_t mosi = SOFT_MOSI_MASK;       \
+    const uint32_t sclk = SOFT_SCLK_MASK;       \
+    const uint32_t miso = SOFT_MISO_SHIFT;      \
+    const uint32_t half = soft_spi_half_cycles; \
+    (void)mosi; (void)miso
 
-        asm volatile("nop");
-        asm volatile("nop");
-        asm volatile("nop");
-    }
-    return temp;
+uint8_t soft_spi_rw(uint8_t data)
+{
+    SOFT_SPI_LOCALS;
+    uint32_t temp = 0;
+
+    SOFT_SPI_BYTE_RW(data, temp);
+    return (uint8_t)temp;
 }
 
 void soft_spi_rw_len(uint8_t *send, uint8_t *recv, uint32_t len)
@@ -81,47 +184,37 @@ void soft_spi_rw_len(uint8_t *send, uint8_t *recv, uint32_t len)
         return;
     }
 
-#if 0
-    uint32_t i = 0;
-    do
-    {
-        *(recv + i) = soft_spi_rw(*(send + i));
-        i++;
-    } while (--len);
-#else
-
-    uint32_t i = 0;
-    uint8_t *stmp = NULL, sf = 0;
+    SOFT_SPI_LOCALS;
+    uint32_t i;
 
-    if (send == NULL)
+    if (send && recv)
     {
-        stmp = (uint8_t *)malloc(len * sizeof(uint8_t));
-        // memset(stmp, 'A', len);
-        sf = 1;
+        for (i = 0; i < len; i++)
+        {
+            uint32_t out = send[i], in = 0;
+            SOFT_SPI_BYTE_RW(out, in);
+            recv[i] = (uint8_t)in;
+        }
     }
-    else
-        stmp = send;
-
-    if (recv == NULL)
+    else if (send)
     {
-        do
+        for (i = 0; i < len; i++)
         {
-            soft_spi_rw(*(stmp + i));
-            i++;
-        } while (--len);
+            uint32_t out = send[i];
+            SOFT_SPI_BYTE_W(out);
+        }
     }
     else
     {
-        do
+        // receive only: MOSI idles high (0xff filler) and is never touched
+        GPIOHS_OUT_VAL |= mosi;
+        for (i = 0; i < len; i++)
         {
-            *(recv + i) = soft_spi_rw(*(stmp + i));
-            i++;
-        } while (--len);
+            uint32_t in = 0;
+            SOFT_SPI_BYTE_R(in);
+            recv[i] = (uint8_t)in;
+        }
     }
-
-    if (sf)
-        free(stmp);
-#endif
 }
 
 
@@ -134,9 +227,21 @@ static spi_transfer_width_t sipeed_spi_get_frame_size(size_t data_bit_length)
     return SPI_TRANS_INT;
 }
 
+/* Hard SPI session state
+ * Inside a begin/end transaction window the controller is configured once;
+ * the transfer mode last written to ctrlr0 is cached so consecutive bytes
+ * and bursts in the same direction skip the register rewrite. */
+#define HARD_SPI_TMOD_UNKNOWN 0xff
+static uint8_t hard_spi_session = 0;
+static uint32_t hard_spi_tmod = HARD_SPI_TMOD_UNKNOWN;
+static uint32_t hard_spi_baudr = 0;
+
 static void hard_spi_set_tmod(uint8_t spi_num, uint32_t tmod)
 {
     configASSERT(spi_num < SPI_DEVICE_MAX && spi_num != 2);
+    if (hard_spi_session && tmod == hard_spi_tmod)
+        return;
+    hard_spi_tmod = tmod;
     volatile spi_t *spi_handle = spi[spi_num];
     uint8_t tmod_offset = 0;
     switch (spi_num)
@@ -243,6 +348,203 @@ static void hard_spi_transfer_data_standard(spi_device_num_t spi_num, spi_chip_s
     spi_handle->ssienr = 0x00;
 }
 
+/* DMA transfers for hard SPI
+ * The SSI data register only takes 32 bit DMA writes, so every byte is
+ * widened to one word. Payloads are widened ESP32_SPI_DMA_CHUNK_LEN bytes
+ * at a time into two small word buffers: the CPU packs/unpacks one chunk
+ * while the DMA engine clocks the other one over the wire. The transfer
+ * is still synchronous, the caller returns once the last chunk is done. */
+#ifndef ESP32_SPI_DMA_TX_CHANNEL
+#define ESP32_SPI_DMA_TX_CHANNEL DMAC_CHANNEL4
+#endif
+#ifndef ESP32_SPI_DMA_RX_CHANNEL
+#define ESP32_SPI_DMA_RX_CHANNEL DMAC_CHANNEL5
+#endif
+// below this a PIO transfer is cheaper than setting up the DMA
+#define HARD_SPI_DMA_MIN_LEN 64
+// bytes widened per DMA chunk, at most SPI_MAX_DMA_LEN; costs 8 bytes of RAM each
+#ifndef ESP32_SPI_DMA_CHUNK_LEN
+#define ESP32_SPI_DMA_CHUNK_LEN 512
+#endif
+#if ESP32_SPI_DMA_CHUNK_LEN > SPI_MAX_DMA_LEN
+#error "ESP32_SPI_DMA_CHUNK_LEN exceeds SPI_MAX_DMA_LEN"
+#endif
+
+static uint32_t hard_spi_dma_buf[2][ESP32_SPI_DMA_CHUNK_LEN] __attribute__((aligned(64)));
+
+static void hard_spi_wait_idle(volatile spi_t *spi_handle)
+{
+    while ((spi_handle->sr & 0x05) != 0x04)
+        ;
+}
+
+static void hard_spi_dma_send_start(const uint32_t *words, uint32_t len)
+{
+    volatile spi_t *spi_handle = spi[SPI_DEVICE_1];
+
+    spi_handle->ssienr = 0x00;
+    hard_spi_set_tmod(SPI_DEVICE_1, SPI_TMOD_TRANS);
+    spi_handle->dmatdlr = 0x10;
+    spi_handle->dmacr = 0x2; /*enable dma transmit*/
+    spi_handle->ssienr = 0x01;
+
+    sysctl_dma_select((sysctl_dma_channel_t)ESP32_SPI_DMA_TX_CHANNEL, SYSCTL_DMA_SELECT_SSI0_TX_REQ + SPI_DEVICE_1 * 2);
+    dmac_set_single_mode(ESP32_SPI_DMA_TX_CHANNEL, words, (void *)(&spi_handle->dr[0]), DMAC_ADDR_INCREMENT, DMAC_ADDR_NOCHANGE,
+                         DMAC_MSIZE_4, DMAC_TRANS_WIDTH_32, len);
+    spi_handle->ser = 1U << SPI_CHIP_SELECT_0;
+}
+
+static void hard_spi_dma_recv_start(uint32_t *words, uint32_t len)
+{
+    volatile spi_t *spi_handle = spi[SPI_DEVICE_1];
+
+    spi_handle->ssienr = 0x00;
+    hard_spi_set_tmod(SPI_DEVICE_1, SPI_TMOD_RECV);
+    spi_handle->ctrlr1 = (uint32_t)(len - 1);
+    spi_handle->dmardlr = 0x0;
+    spi_handle->dmacr = 0x1; /*enable dma receive*/
+    spi_handle->ssienr = 0x01;
+
+    sysctl_dma_select((sysctl_dma_channel_t)ESP32_SPI_DMA_RX_CHANNEL, SYSCTL_DMA_SELECT_SSI0_RX_REQ + SPI_DEVICE_1 * 2);
+    dmac_set_single_mode(ESP32_SPI_DMA_RX_CHANNEL, (void *)(&spi_handle->dr[0]), words, DMAC_ADDR_NOCHANGE, DMAC_ADDR_INCREMENT,
+                         DMAC_MSIZE_1, DMAC_TRANS_WIDTH_32, len);
+    // receive only mode starts clocking on the first dummy write
+    spi_handle->dr[0] = 0xffffffff;
+    spi_handle->ser = 1U << SPI_CHIP_SELECT_0;
+}
+
+static void hard_spi_dma_stop(void)
+{
+    volatile spi_t *spi_handle = spi[SPI_DEVICE_1];
+
+    spi_handle->ser = 0x00;
+    spi_handle->ssienr = 0x00;
+    spi_handle->dmacr = 0x00;
+}
+
+static void hard_spi_send_dma(const uint8_t *send, uint32_t len)
+{
+    volatile spi_t *spi_handle = spi[SPI_DEVICE_1];
+    uint32_t off = 0, cur = 0, n, i;
+
+    n = len < ESP32_SPI_DMA_CHUNK_LEN ? len : ESP32_SPI_DMA_CHUNK_LEN;
+    for (i = 0; i < n; i++)
+        hard_spi_dma_buf[cur][i] = send[i];
+
+    while (1)
+    {
+        hard_spi_dma_send_start(hard_spi_dma_buf[cur], n);
+        off += n;
+
+        // pack the next chunk while this one is on the wire
+        uint32_t next = len - off < ESP32_SPI_DMA_CHUNK_LEN ? len - off : ESP32_SPI_DMA_CHUNK_LEN;
+        for (i = 0; i < next; i++)
+            hard_spi_dma_buf[cur ^ 1][i] = send[off + i];
+
+        dmac_wait_done(ESP32_SPI_DMA_TX_CHANNEL);
+        hard_spi_wait_idle(spi_handle);
+
+        if (next == 0)
+            break;
+        cur ^= 1;
+        n = next;
+    }
+    hard_spi_dma_stop();
+}
+
+static void hard_spi_recv_dma(uint8_t *recv, uint32_t len)
+{
+    uint32_t off = 0, cur = 0, n, i;
+
+    n = len < ESP32_SPI_DMA_CHUNK_LEN ? len : ESP32_SPI_DMA_CHUNK_LEN;
+    hard_spi_dma_recv_start(hard_spi_dma_buf[cur], n);
+
+    while (1)
+    {
+        dmac_wait_done(ESP32_SPI_DMA_RX_CHANNEL);
+
+        // start the next chunk before unpacking this one
+        uint32_t next = len - off - n < ESP32_SPI_DMA_CHUNK_LEN ? len - off - n : ESP32_SPI_DMA_CHUNK_LEN;
+        if (next)
+            hard_spi_dma_recv_start(hard_spi_dma_buf[cur ^ 1], next);
+
+        for (i = 0; i < n; i++)
+            recv[off + i] = (uint8_t)hard_spi_dma_buf[cur][i];
+        off += n;
+
+        if (next == 0)
+            break;
+        cur ^= 1;
+        n = next;
+    }
+    hard_spi_dma_stop();
+}
+
+static void hard_spi_send_pio(const uint8_t *send, uint32_t len)
+{
+    volatile spi_t *spi_handle = spi[SPI_DEVICE_1];
+    uint32_t fifo_len, index;
+
+    hard_spi_set_tmod(SPI_DEVICE_1, SPI_TMOD_TRANS);
+    spi_handle->ssienr = 0x01;
+    spi_handle->ser = 1U << SPI_CHIP_SELECT_0;
+    while (len)
+    {
+        fifo_len = 32 - spi_handle->txflr;
+        fifo_len = fifo_len < len ? fifo_len : len;
+        for (index = 0; index < fifo_len; index++)
+            spi_handle->dr[0] = *send++;
+        len -= fifo_len;
+    }
+    hard_spi_wait_idle(spi_handle);
+    spi_handle->ser = 0x00;
+    spi_handle->ssienr = 0x00;
+}
+
+static void hard_spi_recv_pio(uint8_t *recv, uint32_t len)
+{
+    volatile spi_t *spi_handle = spi[SPI_DEVICE_1];
+    uint32_t fifo_len, index;
+
+    hard_spi_set_tmod(SPI_DEVICE_1, SPI_TMOD_RECV);
+    spi_handle->ctrlr1 = (uint32_t)(len - 1);
+    spi_handle->ssienr = 0x01;
+    // receive only mode starts clocking on the first dummy write
+    spi_handle->dr[0] = 0xffffffff;
+    spi_handle->ser = 1U << SPI_CHIP_SELECT_0;
+    while (len)
+    {
+        fifo_len = spi_handle->rxflr;
+        fifo_len = fifo_len < len ? fifo_len : len;
+        for (index = 0; index < fifo_len; index++)
+            *recv++ = (uint8_t)spi_handle->dr[0];
+        len -= fifo_len;
+    }
+    spi_handle->ser = 0x00;
+    spi_handle->ssienr = 0x00;
+}
+
+// 8 bit standard frames at our clock; SPI1 may be shared (e.g. SD card),
+// so this is redone at the start of every session
+static void hard_spi_configure(void)
+{
+    spi_init(SPI_DEVICE_1, SPI_WORK_MODE_0, SPI_FF_STANDARD, 8, 0);
+    if (hard_spi_baudr)
+        spi[SPI_DEVICE_1]->baudr = hard_spi_baudr;
+    hard_spi_tmod = HARD_SPI_TMOD_UNKNOWN;
+}
+
+void hard_spi_begin_transaction(void)
+{
+    hard_spi_configure();
+    hard_spi_session = 1;
+}
+
+void hard_spi_end_transaction(void)
+{
+    hard_spi_session = 0;
+}
+
 /* SPI端口初始化 */
 // void soft_spi_init(void)
 void hard_spi_config_io()
@@ -250,7 +552,7 @@ void hard_spi_config_io()
     printf("hard spi\r\n");
     //init SPI_DEVICE_1
     // spi_init(SPI_DEVICE_1, SPI_WORK_MODE_0, SPI_FF_STANDARD, 8, 0);
-    printf("esp32 set hard spi clk:%d\r\n", spi_set_clk_rate(SPI_DEVICE_1, 1000000 * 9)); /*set clk rate*/
+    printf("esp32 set hard spi clk:%d\r\n", hard_spi_set_clk_rate(ESP32_SPI_CLK_DEFAULT)); /*set clk rate*/
 
     // fpioa_set_function(27, FUNC_SPI1_SCLK);
     // fpioa_set_function(28, FUNC_SPI1_D0);
@@ -258,10 +560,20 @@ void hard_spi_config_io()
 
 }
 
+//Change the hard SPI clock, takes effect from the next transaction
+//returns the rate actually achieved by the divider
+uint32_t hard_spi_set_clk_rate(uint32_t rate)
+{
+    uint32_t real = spi_set_clk_rate(SPI_DEVICE_1, rate);
+    hard_spi_baudr = spi[SPI_DEVICE_1]->baudr;
+    return real;
+}
+
 uint8_t hard_spi_rw(uint8_t data)
 {
     uint8_t c;
-    spi_init(SPI_DEVICE_1, SPI_WORK_MODE_0, SPI_FF_STANDARD, 8, 0);
+    if (!hard_spi_session)
+        hard_spi_configure();
     hard_spi_transfer_data_standard(SPI_DEVICE_1, SPI_CHIP_SELECT_0, &data, 1, &c, 1);
     return c;
 }
@@ -295,21 +607,26 @@ void hard_spi_rw_len(uint8_t *send, uint8_t *recv, uint32_t len)
         return;
     }
 
-#if 0
-    spi_init(SPI_DEVICE_1, SPI_WORK_MODE_0, SPI_FF_STANDARD, 8, 0);
-#endif
+    if (!hard_spi_session)
+        hard_spi_configure();
 
     //only send
     if (send && recv == NULL)
     {
-        spi_send_data_standard(SPI_DEVICE_1, SPI_CHIP_SELECT_0, NULL, 0, send, len);
+        if (len >= HARD_SPI_DMA_MIN_LEN)
+            hard_spi_send_dma(send, len);
+        else
+            hard_spi_send_pio(send, len);
         return;
     }
 
     //only recv
     if (send == NULL && recv)
     {
-        spi_receive_data_standard(SPI_DEVICE_1, SPI_CHIP_SELECT_0, NULL, 0, recv, len);
+        if (len >= HARD_SPI_DMA_MIN_LEN)
+            hard_spi_recv_dma(recv, len);
+        else
+            hard_spi_recv_pio(recv, len);
         return;
     }
 
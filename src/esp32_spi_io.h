@@ -10,10 +10,14 @@ extern "C" {
 void soft_spi_config_io(uint8_t mosi, uint8_t miso, uint8_t sclk);
 uint8_t soft_spi_rw(uint8_t data);
 void soft_spi_rw_len(uint8_t *send, uint8_t *recv, uint32_t len);
+uint32_t soft_spi_set_clk_rate(uint32_t rate);
 
 void hard_spi_config_io();
 uint8_t hard_spi_rw(uint8_t data);
 void hard_spi_rw_len(uint8_t *send, uint8_t *recv, uint32_t len);
+void hard_spi_begin_transaction(void);
+void hard_spi_end_transaction(void);
+uint32_t hard_spi_set_clk_rate(uint32_t rate);
 
 uint64_t get_millis(void);
 